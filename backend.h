@@ -0,0 +1,74 @@
+#ifndef LAB0_BACKEND_H
+#define LAB0_BACKEND_H
+
+/* Storage backends of the queue other than the linked list.
+ *
+ * A backend only knows how to hold element pointers in order. queue.c
+ * dispatches every queue.h operation on queue_t.backend: the list backend
+ * is implemented there directly, the others through the table below, and
+ * operations which rearrange or drop elements in bulk are built once on top
+ * of gather() and scatter(). Backends keep queue_t.size up to date.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// clang-format off
+#include "queue.h"
+#include "custom.h"
+// clang-format on
+
+/**
+ * queue_ops_t - Operations a storage backend provides
+ * @create: allocate an empty queue, NULL for allocation failed
+ * @destroy: release the storage of an empty queue and the header itself
+ * @push_head: store @e in front, false for allocation failed
+ * @push_tail: store @e at the back, false for allocation failed
+ * @pop_head: take the first element out, NULL if empty
+ * @pop_tail: take the last element out, NULL if empty
+ * @gather: copy every element pointer, in order, to @out
+ * @scatter: replace the contents by the first @n pointers of @in, where
+ *           @n never exceeds the current size. Only storage which is no
+ *           longer needed may be released, so a call with an unchanged
+ *           size must not touch the allocator.
+ * @absorb: append everything in @src to @dst, leaving @src empty, without
+ *          allocating. Return false if @dst has no room for it.
+ * @reserve: make room for @n elements, so absorbing into the queue up to
+ *           that size cannot fail. NULL if absorb() never runs out of room.
+ * @reverse: reverse the order of the elements
+ * @swap: swap every two adjacent elements
+ * @reverse_k: reverse the elements @k at a time
+ * @iter_first: position @it on the first element, or the last one when
+ *              @backward, and return it. NULL if empty.
+ * @iter_step: move @it one position and return the element there, NULL
+ *             past either end
+ * @iter_at: position @it on the element at @rank, less than the size, and
+ *           return it
+ * @iter_store: replace the element @it is on by @e, without moving @it
+ *
+ * None of them is called with a NULL queue.
+ */
+typedef struct {
+    queue_t *(*create)(void);
+    void (*destroy)(queue_t *q);
+    bool (*push_head)(queue_t *q, element_t *e);
+    bool (*push_tail)(queue_t *q, element_t *e);
+    element_t *(*pop_head)(queue_t *q);
+    element_t *(*pop_tail)(queue_t *q);
+    void (*gather)(queue_t *q, element_t **out);
+    void (*scatter)(queue_t *q, element_t **in, size_t n);
+    bool (*absorb)(queue_t *dst, queue_t *src);
+    bool (*reserve)(queue_t *q, size_t n);
+    void (*reverse)(queue_t *q);
+    void (*swap)(queue_t *q);
+    void (*reverse_k)(queue_t *q, int k);
+    element_t *(*iter_first)(queue_t *q, q_iter_t *it, bool backward);
+    element_t *(*iter_step)(q_iter_t *it, bool backward);
+    element_t *(*iter_at)(queue_t *q, q_iter_t *it, size_t rank);
+    void (*iter_store)(q_iter_t *it, element_t *e);
+} queue_ops_t;
+
+extern const queue_ops_t chunk_ops;
+extern const queue_ops_t ring_ops;
+
+#endif /* LAB0_BACKEND_H */
@@ -0,0 +1,435 @@
+/* pthread_setaffinity_np() is a GNU extension */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cbench.h"
+#include "cqueue.h"
+#include "harness.h"
+
+/* Capacity of the queue between producers and consumers */
+#define BENCH_QUEUE_CAP 1024
+
+/* Queues bench_mpmc() and bench_blocking() can pass elements through */
+enum { BENCH_LOCKFREE, BENCH_MUTEX, BENCH_BLOCKING };
+
+/* Elements a producer of bench_blocking() inserts at once */
+#define BENCH_BATCH 16
+
+/**
+ * mpmc_bench_t - State shared by the threads of a multi-producer benchmark
+ * @kind: which of the queues below is used
+ * @q: the lock-free queue
+ * @lock: protects @list
+ * @list: the queue under a mutex
+ * @bq: the blocking queue
+ * @items: the elements
+ * @owner: the producer sending each of @items
+ * @n: number of @items
+ * @producers: number of producer threads
+ * @seen: how many times each element was consumed
+ * @go: set to 1 to start the threads, -1 to send them home
+ * @consumed: number of elements taken out so far
+ * @errors: order violations the consumers noticed
+ */
+typedef struct {
+    int kind;
+    mpmc_t *q;
+    pthread_mutex_t lock;
+    struct list_head list;
+    bqueue_t *bq;
+    element_t *items;
+    unsigned char *owner;
+    size_t n;
+    int producers;
+    unsigned char *seen;
+    int go;
+    size_t consumed;
+    size_t errors;
+} mpmc_bench_t;
+
+typedef struct {
+    mpmc_bench_t *b;
+    int id;
+} mpmc_worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static double now(void)
+{
+    return now_ns() * 1e-9;
+}
+
+/* Keep the calling thread on the @i-th CPU, counting round robin */
+static void pin_thread(int i)
+{
+#if defined(__linux__)
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (ncpu < 2)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(i % ncpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+/* Wait for the starting signal, false if the run was called off */
+static bool wait_go(const int *go)
+{
+    int v;
+    while (!(v = __atomic_load_n(go, __ATOMIC_ACQUIRE)))
+        sched_yield();
+    return v > 0;
+}
+
+/* Start @n threads running @fn, the i-th one on the i-th of @args, which
+ * are @stride bytes apart. They keep SIGALRM blocked, so the time limit of
+ * qtest only ever interrupts the main thread.
+ *
+ * Return: the number of threads started
+ */
+static int start_threads(pthread_t *tids,
+                         int n,
+                         void *(*fn)(void *),
+                         void *args,
+                         size_t stride)
+{
+    sigset_t mask, old;
+    int started = 0;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    while (started < n &&
+           !pthread_create(&tids[started], NULL, fn,
+                           (char *) args + started * stride))
+        started++;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return started;
+}
+
+static void join_threads(pthread_t *tids, int n)
+{
+    for (int i = 0; i < n; i++)
+        pthread_join(tids[i], NULL);
+}
+
+static void mpmc_put(mpmc_bench_t *b, element_t *e)
+{
+    if (b->kind == BENCH_MUTEX) {
+        pthread_mutex_lock(&b->lock);
+        list_add_tail(&e->list, &b->list);
+        pthread_mutex_unlock(&b->lock);
+        return;
+    }
+
+    while (!mpmc_insert_tail(b->q, e))
+        sched_yield();
+}
+
+/* Next element for a consumer, NULL once every element was handed out */
+static element_t *mpmc_take(mpmc_bench_t *b)
+{
+    if (b->kind == BENCH_BLOCKING)
+        return bq_remove_head_wait(b->bq, -1);
+
+    while (__atomic_load_n(&b->consumed, __ATOMIC_RELAXED) < b->n) {
+        element_t *e = NULL;
+        if (b->kind == BENCH_LOCKFREE) {
+            e = mpmc_remove_head(b->q);
+        } else {
+            pthread_mutex_lock(&b->lock);
+            if (!list_empty(&b->list)) {
+                e = list_first_entry(&b->list, element_t, list);
+                list_del(&e->list);
+            }
+            pthread_mutex_unlock(&b->lock);
+        }
+
+        if (e) {
+            __atomic_fetch_add(&b->consumed, 1, __ATOMIC_RELAXED);
+            return e;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *mpmc_producer(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    mpmc_bench_t *b = w->b;
+
+    if (!wait_go(&b->go))
+        return NULL;
+
+    size_t lo = b->n * w->id / b->producers;
+    size_t hi = b->n * (w->id + 1) / b->producers;
+    if (b->kind != BENCH_BLOCKING) {
+        for (size_t i = lo; i < hi; i++)
+            mpmc_put(b, &b->items[i]);
+        return NULL;
+    }
+
+    element_t *batch[BENCH_BATCH];
+    for (size_t i = lo; i < hi;) {
+        size_t k = 0;
+        while (k < BENCH_BATCH && i < hi)
+            batch[k++] = &b->items[i++];
+        bq_insert_tail_batch(b->bq, batch, k, -1);
+    }
+    return NULL;
+}
+
+static void *mpmc_consumer(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    mpmc_bench_t *b = w->b;
+    size_t next[MAX_BENCH_THREADS] = {0}, errors = 0;
+
+    if (!wait_go(&b->go))
+        return NULL;
+
+    for (element_t *e; (e = mpmc_take(b));) {
+        /* Elements of one producer have to come out in increasing order */
+        size_t idx = e - b->items;
+        if (idx < next[b->owner[idx]])
+            errors++;
+        next[b->owner[idx]] = idx + 1;
+        __atomic_fetch_add(&b->seen[idx], 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_add(&b->errors, errors, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Run a multi-producer benchmark on the queue @b was set up with */
+static bool run_mpmc(mpmc_bench_t *b, int consumers, bench_result_t *res)
+{
+    pthread_t tids[2 * MAX_BENCH_THREADS];
+    mpmc_worker_t workers[2 * MAX_BENCH_THREADS];
+    size_t n = b->n;
+    int producers = b->producers;
+    bool ok = false;
+
+    if (producers < 1 || producers > MAX_BENCH_THREADS || consumers < 1 ||
+        consumers > MAX_BENCH_THREADS)
+        return false;
+
+    b->items = malloc(n * sizeof(element_t));
+    b->owner = malloc(n);
+    b->seen = malloc(n);
+    if (!b->items || !b->owner || !b->seen)
+        goto out;
+    memset(b->seen, 0, n);
+    pthread_mutex_init(&b->lock, NULL);
+    INIT_LIST_HEAD(&b->list);
+
+    for (int p = 0; p < producers; p++) {
+        for (size_t i = n * p / producers; i < n * (p + 1) / producers; i++)
+            b->owner[i] = p;
+    }
+    for (int i = 0; i < producers + consumers; i++) {
+        workers[i].b = b;
+        workers[i].id = i < producers ? i : i - producers;
+    }
+
+    int started = start_threads(tids, producers, mpmc_producer, workers,
+                                sizeof(mpmc_worker_t));
+    if (started == producers)
+        started += start_threads(tids + producers, consumers, mpmc_consumer,
+                                 workers + producers, sizeof(mpmc_worker_t));
+    if (started < producers + consumers) {
+        __atomic_store_n(&b->go, -1, __ATOMIC_RELEASE);
+        join_threads(tids, started);
+        goto destroy;
+    }
+
+    double start = now();
+    __atomic_store_n(&b->go, 1, __ATOMIC_RELEASE);
+    /* Consumers of the blocking queue wait for it to be closed */
+    join_threads(tids, producers);
+    if (b->kind == BENCH_BLOCKING)
+        bq_close(b->bq);
+    join_threads(tids + producers, consumers);
+    res->seconds = now() - start;
+
+    res->errors = b->errors;
+    res->latency = res->latency_max = 0;
+    for (size_t i = 0; i < n; i++)
+        res->errors += b->seen[i] != 1;
+    ok = true;
+
+destroy:
+    pthread_mutex_destroy(&b->lock);
+out:
+    free(b->seen);
+    free(b->owner);
+    free(b->items);
+    return ok;
+}
+
+bool bench_mpmc(size_t n,
+                int producers,
+                int consumers,
+                bool locked,
+                bench_result_t *res)
+{
+    mpmc_bench_t b = {
+        .kind = locked ? BENCH_MUTEX : BENCH_LOCKFREE,
+        .n = n,
+        .producers = producers,
+    };
+
+    if (!locked && !(b.q = mpmc_new(BENCH_QUEUE_CAP)))
+        return false;
+
+    bool ok = run_mpmc(&b, consumers, res);
+    mpmc_free(b.q);
+    return ok;
+}
+
+bool bench_blocking(size_t n,
+                    int producers,
+                    int consumers,
+                    size_t capacity,
+                    bench_result_t *res,
+                    bq_stats_t *stats)
+{
+    mpmc_bench_t b = {
+        .kind = BENCH_BLOCKING,
+        .n = n,
+        .producers = producers,
+    };
+
+    if (!(b.bq = bq_new(capacity)))
+        return false;
+
+    bool ok = run_mpmc(&b, consumers, res);
+    bq_stats(b.bq, stats);
+    bq_free(b.bq);
+    return ok;
+}
+
+/**
+ * spsc_bench_t - State shared by the two threads of bench_spsc()
+ * @q: the queue
+ * @items: the elements
+ * @sent: when the producer sent each of @items, in ns
+ * @n: number of @items
+ * @go: set to 1 to start the threads, -1 to send them home
+ * @errors: elements the consumer got out of order
+ * @latency: sum of the times the elements spent in the queue, in ns
+ * @latency_max: longest of those times, in ns
+ */
+typedef struct {
+    spsc_t *q;
+    element_t *items;
+    uint64_t *sent;
+    size_t n;
+    int go;
+    size_t errors;
+    uint64_t latency;
+    uint64_t latency_max;
+} spsc_bench_t;
+
+static void *spsc_producer(void *arg)
+{
+    spsc_bench_t *b = arg;
+
+    pin_thread(0);
+    if (!wait_go(&b->go))
+        return NULL;
+
+    for (size_t i = 0; i < b->n; i++) {
+        element_t *e = &b->items[i];
+        b->sent[i] = now_ns();
+        while (!spsc_insert_tail(b->q, e))
+            sched_yield();
+    }
+    spsc_publish(b->q);
+    return NULL;
+}
+
+static void *spsc_consumer(void *arg)
+{
+    spsc_bench_t *b = arg;
+    uint64_t sum = 0, max = 0;
+    size_t errors = 0;
+
+    pin_thread(1);
+    if (!wait_go(&b->go))
+        return NULL;
+
+    for (size_t got = 0, next = 0; got < b->n; got++) {
+        element_t *e;
+        while (!(e = spsc_remove_head(b->q)))
+            sched_yield();
+
+        uint64_t wait = now_ns() - b->sent[e - b->items];
+        sum += wait;
+        if (wait > max)
+            max = wait;
+        if (e != &b->items[next])
+            errors++;
+        next = e - b->items + 1;
+    }
+
+    b->errors = errors;
+    b->latency = sum;
+    b->latency_max = max;
+    return NULL;
+}
+
+bool bench_spsc(size_t n, int batch, bench_result_t *res)
+{
+    pthread_t tids[2];
+    spsc_bench_t b = {.n = n};
+    bool ok = false;
+
+    b.items = malloc(n * sizeof(element_t));
+    b.sent = malloc(n * sizeof(uint64_t));
+    b.q = spsc_new(BENCH_QUEUE_CAP, batch);
+    if (!b.items || !b.sent || !b.q)
+        goto out;
+
+    int started = start_threads(tids, 1, spsc_producer, &b, 0);
+    if (started == 1)
+        started += start_threads(tids + 1, 1, spsc_consumer, &b, 0);
+    if (started < 2) {
+        __atomic_store_n(&b.go, -1, __ATOMIC_RELEASE);
+        join_threads(tids, started);
+        goto out;
+    }
+
+    double start = now();
+    __atomic_store_n(&b.go, 1, __ATOMIC_RELEASE);
+    join_threads(tids, started);
+    res->seconds = now() - start;
+
+    res->errors = b.errors;
+    res->latency = b.latency * 1e-9 / n;
+    res->latency_max = b.latency_max * 1e-9;
+    ok = true;
+
+out:
+    spsc_free(b.q);
+    free(b.sent);
+    free(b.items);
+    return ok;
+}
@@ -0,0 +1,87 @@
+#ifndef LAB0_CBENCH_H
+#define LAB0_CBENCH_H
+
+/* Stress tests and throughput benchmarks of the queues in cqueue.h, run by
+ * qtest.
+ *
+ * Every benchmark creates its elements up front, starts its threads, then
+ * times how long they take to hand every element from the producers over
+ * to the consumers. Consumers check on the way that each element arrives
+ * exactly once, and that those of one producer arrive in the order it
+ * sent them.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cqueue.h"
+
+/* Most threads a benchmark runs on each side */
+#define MAX_BENCH_THREADS 64
+
+/**
+ * bench_result_t - Outcome of a benchmark run
+ * @seconds: wall time from starting the threads to the last element
+ *           consumed
+ * @errors: elements which were lost, delivered twice or out of order
+ * @latency: mean time an element spent between producer and consumer, in
+ *           seconds, 0 if the benchmark does not measure it
+ * @latency_max: longest such time
+ */
+typedef struct {
+    double seconds;
+    size_t errors;
+    double latency;
+    double latency_max;
+} bench_result_t;
+
+/**
+ * bench_mpmc() - Pass @n elements through one multi-producer queue
+ * @n: number of elements, shared out evenly among the producers
+ * @producers: threads inserting at the tail
+ * @consumers: threads removing from the head
+ * @locked: use a linked list under a mutex instead of mpmc_t, as a
+ *          baseline
+ * @res: where to store the outcome
+ *
+ * Return: false for allocation failed, or no thread could be started
+ */
+bool bench_mpmc(size_t n,
+                int producers,
+                int consumers,
+                bool locked,
+                bench_result_t *res);
+
+/**
+ * bench_blocking() - Pass @n elements through one blocking queue
+ * @n: number of elements, shared out evenly among the producers
+ * @producers: threads inserting at the tail, in batches
+ * @consumers: threads removing from the head, sleeping while it is empty
+ * @capacity: limit of the queue, 0 for none
+ * @res: where to store the outcome
+ * @stats: where to store the contention counters of the queue
+ *
+ * Return: false for allocation failed, or no thread could be started
+ */
+bool bench_blocking(size_t n,
+                    int producers,
+                    int consumers,
+                    size_t capacity,
+                    bench_result_t *res,
+                    bq_stats_t *stats);
+
+/**
+ * bench_spsc() - Pass @n elements from one thread to another
+ * @n: number of elements
+ * @batch: insertions the producer publishes at once, see spsc_new()
+ * @res: where to store the outcome, latency included
+ *
+ * The producer and the consumer are pinned to different CPUs where there
+ * are several. Each element is stamped with the time it is handed over, so
+ * the latency includes the time it waited for its batch to be published.
+ *
+ * Return: false for allocation failed, or the threads could not be started
+ */
+bool bench_spsc(size_t n, int batch, bench_result_t *res);
+
+#endif /* LAB0_CBENCH_H */
@@ -0,0 +1,353 @@
+#include <string.h>
+
+#include "backend.h"
+
+/* Unrolled list backend: element pointers are kept in chunks linked after
+ * queue_t.head, so walking the queue touches a few cache lines per chunk
+ * instead of one node per element.
+ *
+ * Every chunk of a non-empty queue holds at least one element. An empty
+ * queue keeps one empty chunk around, so a queue which keeps going back to
+ * empty does not allocate a chunk on every insertion.
+ */
+
+/* Element pointers per chunk. With the chunk header, and the header the
+ * pool puts in front of it, a chunk fills the largest pool class: 256
+ * bytes, four cache lines.
+ */
+#define CHUNK_SLOTS 28
+
+/**
+ * chunk_t - Block of consecutive element pointers
+ * @list: linked after queue_t.head, in queue order
+ * @first: index of the first used slot
+ * @count: number of used slots, contiguous from @first
+ * @slot: the element pointers
+ */
+typedef struct {
+    struct list_head list;
+    unsigned short first;
+    unsigned short count;
+    element_t *slot[CHUNK_SLOTS];
+} chunk_t;
+
+#define chunk_of(node) list_entry(node, chunk_t, list)
+
+/* Allocate an empty chunk whose free slots all lie before @first */
+static chunk_t *chunk_new(size_t first)
+{
+    chunk_t *c = pool_alloc(sizeof(chunk_t));
+    if (!c)
+        return NULL;
+
+    c->first = first;
+    c->count = 0;
+    return c;
+}
+
+static queue_t *chunk_create(void)
+{
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
+        return NULL;
+
+    chunk_t *c = chunk_new(CHUNK_SLOTS / 2);
+    if (!c) {
+        free(q);
+        return NULL;
+    }
+
+    INIT_LIST_HEAD(&q->head);
+    list_add(&c->list, &q->head);
+    q->size = 0;
+    q->backend = Q_BACKEND_CHUNK;
+    return q;
+}
+
+static void chunk_destroy(queue_t *q)
+{
+    struct list_head *node, *safe;
+    list_for_each_safe (node, safe, &q->head)
+        pool_free(chunk_of(node));
+    free(q);
+}
+
+static bool chunk_push_head(queue_t *q, element_t *e)
+{
+    chunk_t *c = list_empty(&q->head) ? NULL : chunk_of(q->head.next);
+
+    /* An empty chunk leaves room on both sides */
+    if (c && c->count == 0)
+        c->first = CHUNK_SLOTS / 2;
+    if (!c || c->first == 0) {
+        c = chunk_new(CHUNK_SLOTS);
+        if (!c)
+            return false;
+        list_add(&c->list, &q->head);
+    }
+
+    c->slot[--c->first] = e;
+    c->count++;
+    q->size++;
+    return true;
+}
+
+static bool chunk_push_tail(queue_t *q, element_t *e)
+{
+    chunk_t *c = list_empty(&q->head) ? NULL : chunk_of(q->head.prev);
+
+    if (c && c->count == 0)
+        c->first = CHUNK_SLOTS / 2;
+    if (!c || c->first + c->count == CHUNK_SLOTS) {
+        c = chunk_new(0);
+        if (!c)
+            return false;
+        list_add_tail(&c->list, &q->head);
+    }
+
+    c->slot[c->first + c->count++] = e;
+    q->size++;
+    return true;
+}
+
+/* Drop @c once it ran empty, unless it is the last chunk left */
+static void chunk_trim(queue_t *q, chunk_t *c)
+{
+    if (c->count == 0 && !list_is_singular(&q->head)) {
+        list_del(&c->list);
+        pool_free(c);
+    }
+}
+
+static element_t *chunk_pop_head(queue_t *q)
+{
+    if (q->size == 0)
+        return NULL;
+
+    chunk_t *c = chunk_of(q->head.next);
+    element_t *e = c->slot[c->first++];
+    c->count--;
+    q->size--;
+    chunk_trim(q, c);
+    return e;
+}
+
+static element_t *chunk_pop_tail(queue_t *q)
+{
+    if (q->size == 0)
+        return NULL;
+
+    chunk_t *c = chunk_of(q->head.prev);
+    element_t *e = c->slot[c->first + --c->count];
+    q->size--;
+    chunk_trim(q, c);
+    return e;
+}
+
+static void chunk_gather(queue_t *q, element_t **out)
+{
+    struct list_head *node;
+    list_for_each (node, &q->head) {
+        chunk_t *c = chunk_of(node);
+        memcpy(out, &c->slot[c->first], c->count * sizeof(element_t *));
+        out += c->count;
+    }
+}
+
+/* Refill the chunks in place, so the layout only changes where chunks run
+ * out of elements at the end.
+ */
+static void chunk_scatter(queue_t *q, element_t **in, size_t n)
+{
+    struct list_head *node, *safe;
+    size_t left = n;
+
+    list_for_each_safe (node, safe, &q->head) {
+        chunk_t *c = chunk_of(node);
+        if (left == 0 && node != q->head.next) {
+            list_del(node);
+            pool_free(c);
+            continue;
+        }
+
+        size_t cnt = c->count < left ? c->count : left;
+        memcpy(&c->slot[c->first], in, cnt * sizeof(element_t *));
+        in += cnt;
+        left -= cnt;
+        c->count = cnt;
+    }
+    q->size = n;
+}
+
+static bool chunk_absorb(queue_t *dst, queue_t *src)
+{
+    if (src->size == 0)
+        return true;
+
+    /* Hand the empty chunk of @dst over to @src rather than freeing it */
+    LIST_HEAD(spare);
+    if (dst->size == 0)
+        list_splice_init(&dst->head, &spare);
+    list_splice_tail_init(&src->head, &dst->head);
+    list_splice(&spare, &src->head);
+
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+static void chunk_reverse(queue_t *q)
+{
+    struct list_head *node = &q->head;
+
+    /* Reverse the order of the chunks, then the slots inside each one */
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != &q->head);
+
+    list_for_each (node, &q->head) {
+        chunk_t *c = chunk_of(node);
+        for (size_t i = c->first, j = c->first + c->count; i + 1 < j;) {
+            element_t *t = c->slot[i];
+            c->slot[i++] = c->slot[--j];
+            c->slot[j] = t;
+        }
+    }
+}
+
+static element_t *chunk_iter_first(queue_t *q, q_iter_t *it, bool backward)
+{
+    it->head = &q->head;
+    if (q->size == 0)
+        return NULL;
+
+    chunk_t *c = chunk_of(backward ? q->head.prev : q->head.next);
+    it->node = &c->list;
+    it->idx = backward ? c->first + c->count - 1 : c->first;
+    return c->slot[it->idx];
+}
+
+static element_t *chunk_iter_step(q_iter_t *it, bool backward)
+{
+    chunk_t *c = chunk_of(it->node);
+
+    if (backward) {
+        if (it->idx > c->first)
+            return c->slot[--it->idx];
+        it->node = it->node->prev;
+        if (it->node == it->head)
+            return NULL;
+        c = chunk_of(it->node);
+        it->idx = c->first + c->count - 1;
+    } else {
+        if (++it->idx < (size_t) c->first + c->count)
+            return c->slot[it->idx];
+        it->node = it->node->next;
+        if (it->node == it->head)
+            return NULL;
+        c = chunk_of(it->node);
+        it->idx = c->first;
+    }
+    return c->slot[it->idx];
+}
+
+/* Skip whole chunks from the nearer end, then index into the right one */
+static element_t *chunk_iter_at(queue_t *q, q_iter_t *it, size_t rank)
+{
+    struct list_head *node;
+
+    if (rank < (size_t) q->size / 2) {
+        for (node = q->head.next; rank >= chunk_of(node)->count;
+             node = node->next)
+            rank -= chunk_of(node)->count;
+    } else {
+        size_t after = q->size - 1 - rank;
+        for (node = q->head.prev; after >= chunk_of(node)->count;
+             node = node->prev)
+            after -= chunk_of(node)->count;
+        rank = chunk_of(node)->count - 1 - after;
+    }
+
+    chunk_t *c = chunk_of(node);
+    it->head = &q->head;
+    it->node = node;
+    it->idx = c->first + rank;
+    return c->slot[it->idx];
+}
+
+static inline element_t **slot_at(const q_iter_t *it)
+{
+    return &chunk_of(it->node)->slot[it->idx];
+}
+
+static inline void swap_slots(const q_iter_t *a, const q_iter_t *b)
+{
+    element_t *t = *slot_at(a);
+    *slot_at(a) = *slot_at(b);
+    *slot_at(b) = t;
+}
+
+static void chunk_swap(queue_t *q)
+{
+    q_iter_t a, b;
+
+    for (bool more = chunk_iter_first(q, &a, false); more;) {
+        b = a;
+        if (!chunk_iter_step(&b, false))
+            break;
+        swap_slots(&a, &b);
+        a = b;
+        more = chunk_iter_step(&a, false);
+    }
+}
+
+static void chunk_reverse_k(queue_t *q, int k)
+{
+    q_iter_t front, back;
+
+    if (k <= 1 || !chunk_iter_first(q, &front, false))
+        return;
+
+    for (int groups = q->size / k; groups > 0; groups--) {
+        back = front;
+        for (int i = 1; i < k; i++)
+            chunk_iter_step(&back, false);
+
+        q_iter_t next = back;
+        chunk_iter_step(&next, false);
+
+        for (int i = 0; i < k / 2; i++) {
+            swap_slots(&front, &back);
+            chunk_iter_step(&front, false);
+            chunk_iter_step(&back, true);
+        }
+        front = next;
+    }
+}
+
+static void chunk_iter_store(q_iter_t *it, element_t *e)
+{
+    chunk_of(it->node)->slot[it->idx] = e;
+}
+
+const queue_ops_t chunk_ops = {
+    .create = chunk_create,
+    .destroy = chunk_destroy,
+    .push_head = chunk_push_head,
+    .push_tail = chunk_push_tail,
+    .pop_head = chunk_pop_head,
+    .pop_tail = chunk_pop_tail,
+    .gather = chunk_gather,
+    .scatter = chunk_scatter,
+    .absorb = chunk_absorb,
+    .reverse = chunk_reverse,
+    .swap = chunk_swap,
+    .reverse_k = chunk_reverse_k,
+    .iter_first = chunk_iter_first,
+    .iter_step = chunk_iter_step,
+    .iter_at = chunk_iter_at,
+    .iter_store = chunk_iter_store,
+};
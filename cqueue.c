@@ -0,0 +1,400 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cqueue.h"
+#include "harness.h"
+
+/* Bytes apart two counters must be for threads updating one of them not to
+ * keep stealing the cache line of the other
+ */
+#define CACHE_LINE 64
+
+/**
+ * mpmc_cell_t - One slot of the ring
+ * @seq: the position the cell is ready to be produced into, or that
+ *       position plus one once the element there can be consumed
+ * @e: the element
+ */
+typedef struct {
+    size_t seq;
+    element_t *e;
+} mpmc_cell_t;
+
+struct mpmc {
+    mpmc_cell_t *cells;
+    size_t mask;
+    char pad0[CACHE_LINE];
+    size_t tail; /* next position to produce into */
+    char pad1[CACHE_LINE];
+    size_t head; /* next position to consume from */
+    char pad2[CACHE_LINE];
+};
+
+mpmc_t *mpmc_new(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap <<= 1;
+
+    mpmc_t *q = malloc(sizeof(mpmc_t));
+    if (!q)
+        return NULL;
+    q->cells = malloc(cap * sizeof(mpmc_cell_t));
+    if (!q->cells) {
+        free(q);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cap; i++)
+        q->cells[i].seq = i;
+    q->mask = cap - 1;
+    q->tail = q->head = 0;
+    return q;
+}
+
+void mpmc_free(mpmc_t *q)
+{
+    if (!q)
+        return;
+
+    free(q->cells);
+    free(q);
+}
+
+bool mpmc_insert_tail(mpmc_t *q, element_t *e)
+{
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    mpmc_cell_t *cell;
+
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t lap = (intptr_t) (seq - pos);
+
+        /* Behind: the element of the previous lap was not consumed yet */
+        if (lap < 0)
+            return false;
+        if (lap == 0 &&
+            __atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        /* Ahead: another producer took the position, try the next one */
+        if (lap > 0)
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+
+    cell->e = e;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+element_t *mpmc_remove_head(mpmc_t *q)
+{
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    mpmc_cell_t *cell;
+
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t lap = (intptr_t) (seq - (pos + 1));
+
+        /* Behind: nothing was produced into the cell yet */
+        if (lap < 0)
+            return NULL;
+        if (lap == 0 &&
+            __atomic_compare_exchange_n(&q->head, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        if (lap > 0)
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+
+    element_t *e = cell->e;
+    /* Hand the cell over to the producer of the next lap */
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return e;
+}
+
+struct spsc {
+    element_t **buf;
+    size_t mask;
+    size_t batch;
+    char pad0[CACHE_LINE];
+    /* The positions the other thread reads get a line each, so that its
+     * polling does not steal the line holding the writer's private fields.
+     */
+    size_t tail; /* next position to insert into, published */
+    char pad1[CACHE_LINE];
+    /* Producer side */
+    size_t tail_local; /* next position to insert into */
+    size_t head_cache; /* last value of head the producer read */
+    char pad2[CACHE_LINE];
+    size_t head; /* next position to remove from, published */
+    char pad3[CACHE_LINE];
+    /* Consumer side */
+    size_t tail_cache; /* last value of tail the consumer read */
+    char pad4[CACHE_LINE];
+};
+
+spsc_t *spsc_new(size_t capacity, int batch)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap <<= 1;
+
+    if (batch < 1)
+        return NULL;
+    spsc_t *q = malloc(sizeof(spsc_t));
+    if (!q)
+        return NULL;
+    q->buf = malloc(cap * sizeof(element_t *));
+    if (!q->buf) {
+        free(q);
+        return NULL;
+    }
+
+    q->mask = cap - 1;
+    q->batch = batch;
+    q->tail = q->tail_local = q->head_cache = 0;
+    q->head = q->tail_cache = 0;
+    return q;
+}
+
+void spsc_free(spsc_t *q)
+{
+    if (!q)
+        return;
+
+    free(q->buf);
+    free(q);
+}
+
+void spsc_publish(spsc_t *q)
+{
+    __atomic_store_n(&q->tail, q->tail_local, __ATOMIC_RELEASE);
+}
+
+bool spsc_insert_tail(spsc_t *q, element_t *e)
+{
+    if (q->tail_local - q->head_cache > q->mask) {
+        q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (q->tail_local - q->head_cache > q->mask) {
+            /* Whatever is still unpublished is all the consumer can take */
+            spsc_publish(q);
+            return false;
+        }
+    }
+
+    q->buf[q->tail_local++ & q->mask] = e;
+    if (q->tail_local - q->tail >= q->batch)
+        spsc_publish(q);
+    return true;
+}
+
+element_t *spsc_remove_head(spsc_t *q)
+{
+    size_t head = q->head;
+
+    if (head == q->tail_cache) {
+        q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head == q->tail_cache)
+            return NULL;
+    }
+
+    element_t *e = q->buf[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return e;
+}
+
+struct bqueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct list_head list;
+    size_t size;
+    size_t capacity;
+    int consumers_waiting;
+    int producers_waiting;
+    int consumers_woken; /* signals sent to consumers not yet picked up */
+    int producers_woken;
+    bool closed;
+    bq_stats_t stats;
+};
+
+bqueue_t *bq_new(size_t capacity)
+{
+    bqueue_t *q = malloc(sizeof(bqueue_t));
+    if (!q)
+        return NULL;
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    INIT_LIST_HEAD(&q->list);
+    q->size = 0;
+    q->capacity = capacity;
+    q->consumers_waiting = q->producers_waiting = 0;
+    q->consumers_woken = q->producers_woken = 0;
+    q->closed = false;
+    q->stats = (bq_stats_t){0};
+    return q;
+}
+
+void bq_free(bqueue_t *q)
+{
+    if (!q)
+        return;
+
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+/* Absolute time @timeout_ms from now, as pthread_cond_timedwait() wants */
+static void deadline_after(struct timespec *ts, long timeout_ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += timeout_ms % 1000 * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* Block on @cond, with q->lock held, until woken or past @deadline if not
+ * NULL. @waiting counts the threads blocked on @cond and @woken the signals
+ * sent to them which none of them has seen yet. Return false once the
+ * deadline has passed.
+ */
+static bool bq_wait(bqueue_t *q,
+                    pthread_cond_t *cond,
+                    int *waiting,
+                    int *woken,
+                    const struct timespec *deadline)
+{
+    struct timespec start, end;
+    int ret;
+
+    (*waiting)++;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (deadline)
+        ret = pthread_cond_timedwait(cond, &q->lock, deadline);
+    else
+        ret = pthread_cond_wait(cond, &q->lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    (*waiting)--;
+    if (*woken > 0)
+        (*woken)--;
+
+    q->stats.waits++;
+    q->stats.wait_seconds +=
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    if (ret == ETIMEDOUT) {
+        q->stats.timeouts++;
+        return false;
+    }
+    return true;
+}
+
+size_t bq_insert_tail_batch(bqueue_t *q,
+                            element_t **v,
+                            size_t n,
+                            long timeout_ms)
+{
+    struct timespec deadline;
+    size_t done = 0;
+
+    if (timeout_ms > 0)
+        deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&q->lock);
+    while (done < n && !q->closed) {
+        if (q->capacity && q->size == q->capacity) {
+            if (timeout_ms == 0)
+                break;
+            bool woken =
+                bq_wait(q, &q->not_full, &q->producers_waiting,
+                        &q->producers_woken, timeout_ms > 0 ? &deadline : NULL);
+            if (q->size == q->capacity && !q->closed) {
+                if (!woken)
+                    break;
+                q->stats.spurious++;
+            }
+            continue;
+        }
+
+        size_t room = q->capacity ? q->capacity - q->size : n - done;
+        size_t k = n - done < room ? n - done : room;
+        for (size_t i = 0; i < k; i++)
+            list_add_tail(&v[done + i]->list, &q->list);
+        q->size += k;
+        done += k;
+
+        /* One sleeper per element: the others would only find it empty */
+        for (size_t i = 0;
+             i < k && q->consumers_waiting > q->consumers_woken; i++) {
+            pthread_cond_signal(&q->not_empty);
+            q->consumers_woken++;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return done;
+}
+
+bool bq_insert_tail(bqueue_t *q, element_t *e, long timeout_ms)
+{
+    return bq_insert_tail_batch(q, &e, 1, timeout_ms) == 1;
+}
+
+element_t *bq_remove_head_wait(bqueue_t *q, long timeout_ms)
+{
+    struct timespec deadline;
+    element_t *e = NULL;
+
+    if (timeout_ms > 0)
+        deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&q->lock);
+    while (list_empty(&q->list) && !q->closed && timeout_ms != 0) {
+        bool woken =
+            bq_wait(q, &q->not_empty, &q->consumers_waiting,
+                    &q->consumers_woken, timeout_ms > 0 ? &deadline : NULL);
+        if (list_empty(&q->list) && !q->closed) {
+            if (!woken)
+                break;
+            q->stats.spurious++;
+        }
+    }
+
+    if (!list_empty(&q->list)) {
+        e = list_first_entry(&q->list, element_t, list);
+        list_del(&e->list);
+        q->size--;
+        if (q->producers_waiting > q->producers_woken) {
+            pthread_cond_signal(&q->not_full);
+            q->producers_woken++;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return e;
+}
+
+void bq_close(bqueue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void bq_stats(bqueue_t *q, bq_stats_t *stats)
+{
+    pthread_mutex_lock(&q->lock);
+    *stats = q->stats;
+    pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,219 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/* Queues of element pointers which several threads may use at once.
+ *
+ * The queues in queue.h belong to a single thread. The ones here hand
+ * element_t pointers from producer threads to consumer threads, either
+ * without any lock or, for consumers which would rather sleep than spin,
+ * behind one mutex. Elements are neither copied nor allocated on the way,
+ * so they are best created, and released, by a thread of their own.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/**
+ * mpmc_t - Bounded queue for many producers and many consumers
+ *
+ * A ring of cells, each tagged with a sequence number telling which lap of
+ * the ring it is ready for. A producer claims the next tail position with
+ * one compare-and-swap, fills the cell and publishes it by advancing the
+ * sequence number, and a consumer does the same at the head. Threads never
+ * wait on each other except to retry a lost compare-and-swap. Cells are
+ * reused rather than freed, so no thread can ever touch released memory
+ * and no reclamation scheme is needed.
+ */
+typedef struct mpmc mpmc_t;
+
+/**
+ * mpmc_new() - Create an empty queue
+ * @capacity: the number of elements it must hold, rounded up to a power of
+ *            two, at least 2
+ *
+ * Not thread-safe, like every allocation of the harness.
+ *
+ * Return: the queue, NULL for allocation failed
+ */
+mpmc_t *mpmc_new(size_t capacity);
+
+/**
+ * mpmc_free() - Release a queue nobody uses any more
+ * @q: the queue, no effect if NULL
+ *
+ * Elements still in the queue are not released.
+ */
+void mpmc_free(mpmc_t *q);
+
+/**
+ * mpmc_insert_tail() - Append an element, from any thread
+ * @q: the queue
+ * @e: the element
+ *
+ * Return: false if the queue is full
+ */
+bool mpmc_insert_tail(mpmc_t *q, element_t *e);
+
+/**
+ * mpmc_remove_head() - Take out the first element, from any thread
+ * @q: the queue
+ *
+ * Return: the element, NULL if the queue is empty
+ */
+element_t *mpmc_remove_head(mpmc_t *q);
+
+/**
+ * spsc_t - Queue for exactly one producer and one consumer thread
+ *
+ * A ring of element pointers with one index per side, each on a cache line
+ * of its own. Each side also keeps a private copy of the index of the other
+ * one and only rereads the shared index when the copy says the ring is
+ * full, or empty, so in the common case neither side touches a line the
+ * other writes. Insertions are published in batches: the consumer sees them
+ * once a batch is complete, spsc_publish() is called, or the ring fills up.
+ * Every operation finishes in a bounded number of steps.
+ */
+typedef struct spsc spsc_t;
+
+/**
+ * spsc_new() - Create an empty queue
+ * @capacity: the number of elements it must hold, rounded up to a power of
+ *            two, at least 2
+ * @batch: insertions published together, 1 to publish each one at once
+ *
+ * Return: the queue, NULL for allocation failed or @batch < 1
+ */
+spsc_t *spsc_new(size_t capacity, int batch);
+
+/**
+ * spsc_free() - Release a queue nobody uses any more
+ * @q: the queue, no effect if NULL
+ */
+void spsc_free(spsc_t *q);
+
+/**
+ * spsc_insert_tail() - Append an element, from the producer thread
+ * @q: the queue
+ * @e: the element
+ *
+ * Return: false if the queue is full
+ */
+bool spsc_insert_tail(spsc_t *q, element_t *e);
+
+/**
+ * spsc_publish() - Let the consumer see every element inserted so far
+ * @q: the queue
+ *
+ * Called by the producer thread, typically before it waits or stops.
+ */
+void spsc_publish(spsc_t *q);
+
+/**
+ * spsc_remove_head() - Take out the first element, from the consumer thread
+ * @q: the queue
+ *
+ * Return: the element, NULL if no published element is left
+ */
+element_t *spsc_remove_head(spsc_t *q);
+
+/**
+ * bqueue_t - Queue whose consumers sleep while it is empty
+ *
+ * A list of elements, linked through element_t.list, behind a mutex. A
+ * consumer finding it empty blocks on a condition variable until an element
+ * arrives or its timeout expires. With a capacity, producers likewise block
+ * while it is full, which pushes back on producers faster than their
+ * consumers. An insertion wakes at most as many sleeping consumers as it
+ * brings elements, never all of them, and a batch of insertions takes the
+ * lock once.
+ */
+typedef struct bqueue bqueue_t;
+
+/**
+ * bq_stats_t - Contention counters of a bqueue_t
+ * @waits: times a thread had to block, on either side
+ * @spurious: wakeups which found the queue still empty, or still full
+ * @timeouts: waits which ran out of time
+ * @wait_seconds: total time threads spent blocked
+ */
+typedef struct {
+    size_t waits;
+    size_t spurious;
+    size_t timeouts;
+    double wait_seconds;
+} bq_stats_t;
+
+/**
+ * bq_new() - Create an empty queue
+ * @capacity: most elements it holds at once, 0 for no limit
+ *
+ * Return: the queue, NULL for allocation failed
+ */
+bqueue_t *bq_new(size_t capacity);
+
+/**
+ * bq_free() - Release a queue nobody uses any more
+ * @q: the queue, no effect if NULL
+ *
+ * Elements still in the queue are not released.
+ */
+void bq_free(bqueue_t *q);
+
+/**
+ * bq_insert_tail_batch() - Append @n elements, from any thread
+ * @q: the queue
+ * @v: the elements, in order
+ * @n: number of elements
+ * @timeout_ms: how long to wait for room, negative to wait as long as it
+ *              takes, 0 not to wait at all
+ *
+ * Elements of one batch stay consecutive only when they all fit at once.
+ *
+ * Return: the number of elements inserted, fewer than @n if the timeout
+ * expired or the queue was closed
+ */
+size_t bq_insert_tail_batch(bqueue_t *q,
+                            element_t **v,
+                            size_t n,
+                            long timeout_ms);
+
+/**
+ * bq_insert_tail() - Append an element, from any thread
+ * @q: the queue
+ * @e: the element
+ * @timeout_ms: as for bq_insert_tail_batch()
+ *
+ * Return: false if the timeout expired or the queue was closed
+ */
+bool bq_insert_tail(bqueue_t *q, element_t *e, long timeout_ms);
+
+/**
+ * bq_remove_head_wait() - Take out the first element, from any thread
+ * @q: the queue
+ * @timeout_ms: how long to wait for an element, negative to wait as long as
+ *              it takes, 0 not to wait at all
+ *
+ * Return: the element, NULL if the timeout expired, or the queue was closed
+ * and is empty
+ */
+element_t *bq_remove_head_wait(bqueue_t *q, long timeout_ms);
+
+/**
+ * bq_close() - Tell every thread no more elements will come
+ * @q: the queue
+ *
+ * Wakes every waiting thread. Insertions fail from now on, while removals
+ * still drain what is left without waiting.
+ */
+void bq_close(bqueue_t *q);
+
+/**
+ * bq_stats() - Read the contention counters
+ * @q: the queue
+ * @stats: where to store them
+ */
+void bq_stats(bqueue_t *q, bq_stats_t *stats);
+
+#endif /* LAB0_CQUEUE_H */
@@ -1,6 +1,265 @@
 #ifndef LAB0_CUSTOM_H
 #define LAB0_CUSTOM_H
 
+/**
+ * q_set_backend() - Choose the storage layout of queues created from now on
+ * @backend: one of the Q_BACKEND_* values in queue.h
+ *
+ * Queues which already exist keep their layout. Everything in queue.h and
+ * in this file works on every backend. The extra sort and merge engines,
+ * which rely on the list layout, run q_sort() or q_merge() instead on other
+ * backends.
+ *
+ * Return: false if @backend is unknown, leaving the choice as it was
+ */
+bool q_set_backend(int backend);
+
+/**
+ * q_reserve() - Make room for @n elements in a queue
+ * @head: header of queue
+ * @n: number of elements the queue must be able to hold
+ *
+ * q_merge() may not allocate, so it cannot grow the first queue when its
+ * backend keeps elements in a fixed amount of storage. Reserving the total
+ * size of all queues in the first one beforehand lets the merge take
+ * everything in. A no-op on backends which never run out of room.
+ *
+ * Return: false for NULL queue or allocation failed
+ */
+bool q_reserve(struct list_head *head, int n);
+
+/**
+ * q_iter_t - Position inside a queue, whatever its backend
+ * @head: header of the queue
+ * @node: list node of the element, or of the storage block holding it
+ * @idx: index of the element inside @node, or inside the storage of the
+ *       queue when the backend links no nodes. Unused by the list backend.
+ *
+ * The fields are private to the backend. Removing an element from the
+ * queue invalidates every iterator on it.
+ */
+typedef struct {
+    struct list_head *head;
+    struct list_head *node;
+    size_t idx;
+} q_iter_t;
+
+/**
+ * q_iter_first() - Position an iterator on the first element
+ * @head: header of queue
+ * @it: the iterator
+ *
+ * Return: the first element, NULL if queue is NULL or empty
+ */
+element_t *q_iter_first(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_iter_last() - Position an iterator on the last element
+ * @head: header of queue
+ * @it: the iterator
+ *
+ * Return: the last element, NULL if queue is NULL or empty
+ */
+element_t *q_iter_last(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_iter_next() - Advance an iterator toward the tail
+ * @it: iterator positioned on an element
+ *
+ * Return: the next element, NULL once past the tail
+ */
+element_t *q_iter_next(q_iter_t *it);
+
+/**
+ * q_iter_prev() - Move an iterator toward the head
+ * @it: iterator positioned on an element
+ *
+ * Return: the previous element, NULL once past the head
+ */
+element_t *q_iter_prev(q_iter_t *it);
+
+
+/**
+ * q_insert_head_bulk() - Insert several elements at the head
+ * @head: header of queue
+ * @sv: strings would be inserted
+ * @nsv: number of strings in @sv
+ * @n: number of elements to insert
+ *
+ * The i-th new element holds a copy of sv[i % nsv], so @nsv == 1 repeats a
+ * single string while @nsv == @n inserts a whole array. The result is the
+ * same as calling q_insert_head() for each of them in turn, but the
+ * elements are chained privately and spliced in at once. Either all of them
+ * are inserted or none.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_bulk(struct list_head *head, char **sv, int nsv, int n);
+
+/**
+ * q_insert_tail_bulk() - Insert several elements at the tail
+ * @head: header of queue
+ * @sv: strings would be inserted
+ * @nsv: number of strings in @sv
+ * @n: number of elements to insert
+ *
+ * Same as q_insert_head_bulk(), but equivalent to repeated q_insert_tail().
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_bulk(struct list_head *head, char **sv, int nsv, int n);
+
+/**
+ * q_insert_sorted() - Insert an element in order into a sorted queue
+ * @head: header of queue, sorted in ascending order
+ * @s: string would be inserted
+ *
+ * The element goes after every element which is not greater, as q_sort()
+ * would place it after q_insert_tail(). The spot is searched from the
+ * element inserted by the previous call, the "finger", and from the end of
+ * the queue on the same side of it, both at once, so an insertion costs
+ * O(distance) from the closer of the two. The finger is forgotten whenever
+ * an operation might remove its element.
+ *
+ * Backends other than the list binary search a copy of the element pointers
+ * instead, in O(n).
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_sorted(struct list_head *head, char *s);
+
+/**
+ * q_set_index() - Enable or disable the skip-list index of a queue
+ * @head: header of queue
+ * @enable: build the index, or release it
+ *
+ * The index, see skiplist.h, lets q_find(), q_rank(), q_delete_value() and
+ * q_insert_sorted() search a sorted queue in O(log n), and q_get(),
+ * q_insert_at() and q_delete_at() reach any position as fast. Insertions and
+ * removals of single elements keep it up to date. Operations which rearrange
+ * the whole queue, sorting included, leave it to be rebuilt in O(n) by the
+ * next search which needs it. Only the list backend has an index.
+ *
+ * Return: false for allocation failed, queue is NULL or kept by another
+ * backend
+ */
+bool q_set_index(struct list_head *head, bool enable);
+
+/**
+ * q_find() - Find an element by value in a sorted queue
+ * @head: header of queue, sorted in ascending order
+ * @s: the string to look for
+ *
+ * Without an index the queue is walked from the head, in O(n).
+ *
+ * Return: the first element equal to @s, NULL if there is none or queue is
+ * NULL
+ */
+element_t *q_find(struct list_head *head, const char *s);
+
+/**
+ * q_rank() - Count the elements less than a value in a sorted queue
+ * @head: header of queue, sorted in ascending order
+ * @s: the string to compare with
+ *
+ * This is also the position q_find() would find @s at.
+ *
+ * Return: the number of elements less than @s, zero if queue is NULL
+ */
+int q_rank(struct list_head *head, const char *s);
+
+/**
+ * q_delete_value() - Delete an element by value from a sorted queue
+ * @head: header of queue, sorted in ascending order
+ * @s: the string to delete
+ *
+ * Only the first element equal to @s goes, and it is released here.
+ *
+ * Return: true if an element was deleted, false if there is none equal to
+ * @s or queue is NULL
+ */
+bool q_delete_value(struct list_head *head, const char *s);
+
+/**
+ * q_get() - Get the element at a position
+ * @head: header of queue
+ * @i: position from the head, starting at 0
+ *
+ * With the index of q_set_index() this takes O(log n), whatever the order
+ * of the queue. Without it, a list queue is walked from the head, the tail
+ * or the middle, whichever is nearest. The ring backend reaches any
+ * position in O(1) and the chunk backend skips whole chunks.
+ *
+ * Return: the element, NULL if @i is out of range or queue is NULL
+ */
+element_t *q_get(struct list_head *head, int i);
+
+/**
+ * q_insert_at() - Insert an element at a position
+ * @head: header of queue
+ * @i: position the new element takes, from 0 to the size of the queue
+ * @s: string would be inserted
+ *
+ * The element which was at @i, and every one after it, moves back by one.
+ * The position is found like q_get() does. Backends other than the list
+ * then move the elements after it, in O(n).
+ *
+ * Return: true for success, false for allocation failed, @i out of range or
+ * queue is NULL
+ */
+bool q_insert_at(struct list_head *head, int i, char *s);
+
+/**
+ * q_delete_at() - Delete the element at a position
+ * @head: header of queue
+ * @i: position from the head, starting at 0
+ *
+ * The element is released here. Costs the same as q_insert_at().
+ *
+ * Return: true for success, false if @i is out of range or queue is NULL
+ */
+bool q_delete_at(struct list_head *head, int i);
+
+/**
+ * q_remove_head_bulk() - Remove several elements from the head at once
+ * @head: header of queue
+ * @n: maximum number of elements to remove
+ * @buf: packed buffer receiving the removed strings, may be NULL
+ * @bufsize: size of @buf
+ * @offsets: receives the offset of each string within @buf, may be NULL
+ *
+ * The removed strings are stored back to back in @buf, each followed by a
+ * null terminator, in the order they are removed. Removal stops early at the
+ * first string which does not fit; if not even the first one fits, it is
+ * truncated to @bufsize - 1 characters like q_remove_head() does. The
+ * removed elements are detached with one cut and released here, so the
+ * caller has nothing to free.
+ *
+ * Return: the number of elements removed, zero if queue is NULL or empty
+ */
+int q_remove_head_bulk(struct list_head *head,
+                       int n,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets);
+
+/**
+ * q_remove_tail_bulk() - Remove several elements from the tail at once
+ * @head: header of queue
+ * @n: maximum number of elements to remove
+ * @buf: packed buffer receiving the removed strings, may be NULL
+ * @bufsize: size of @buf
+ * @offsets: receives the offset of each string within @buf, may be NULL
+ *
+ * Same as q_remove_head_bulk(), starting from the tail.
+ *
+ * Return: the number of elements removed, zero if queue is NULL or empty
+ */
+int q_remove_tail_bulk(struct list_head *head,
+                       int n,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets);
 
 /**
  * q_list_sort() - Sort elements of queue in ascending order with list sort
@@ -11,14 +270,174 @@
  */
 void q_list_sort(struct list_head *head);
 
+/**
+ * q_radix_sort() - Sort elements of queue in ascending order with MSD radix
+ * sort
+ * @head: header of queue
+ *
+ * Elements are distributed into byte buckets by relinking their list nodes,
+ * one character position at a time, and small buckets are finished with
+ * merge sort. The sort is stable.
+ *
+ * No effect if queue is NULL or empty. If there has only one element, do
+ * nothing.
+ */
+void q_radix_sort(struct list_head *head);
+
+/**
+ * q_parallel_sort() - Sort elements of queue in ascending order on several
+ * threads
+ * @head: header of queue
+ * @nthreads: number of threads to use
+ *
+ * The queue is cut into @nthreads segments of equal length, which are merge
+ * sorted concurrently and then merged pairwise, again concurrently, until a
+ * single run is left. Nothing is allocated. Queues too short to benefit, or
+ * @nthreads below two, are sorted by q_sort() on the calling thread.
+ *
+ * No effect if queue is NULL or empty. If there has only one element, do
+ * nothing.
+ */
+void q_parallel_sort(struct list_head *head, int nthreads);
+
+/**
+ * q_array_sort() - Sort elements of queue in ascending order through an
+ * array of element pointers
+ * @head: header of queue
+ *
+ * Element pointers and their keys are gathered into a contiguous scratch
+ * buffer (see test_scratch_alloc), merge sorted there and the list is
+ * relinked in one pass. Falls back to q_sort() if no scratch buffer can be
+ * obtained. The sort is stable.
+ *
+ * No effect if queue is NULL or empty. If there has only one element, do
+ * nothing.
+ */
+void q_array_sort(struct list_head *head);
+
+/**
+ * q_parallel_merge() - Merge all the queues into one sorted queue on several
+ * threads
+ * @head: header of chain
+ * @nthreads: number of threads which may take part, the caller included
+ *
+ * Same contract as q_merge(). The sorted queues are merged pairwise in a
+ * balanced reduction tree, and all pairs of one level are shared among the
+ * threads. Falls back to q_merge() for fewer than two threads, for chains
+ * with at most two non-empty queues, or if no scratch buffer is available.
+ *
+ * Return: the number of elements in queue after merging
+ */
+int q_parallel_merge(struct list_head *head, int nthreads);
+
+/**
+ * q_strcmp_fallbacks() - Count comparisons which needed the full strings
+ *
+ * Elements are compared by their cached key first. This reports how many
+ * comparisons since the last q_reset_strcmp_fallbacks() found equal keys
+ * and had to fall back to strcmp().
+ *
+ * Return: the number of comparisons decided by strcmp()
+ */
+size_t q_strcmp_fallbacks(void);
+
+/**
+ * q_reset_strcmp_fallbacks() - Restart counting strcmp() fallbacks
+ */
+void q_reset_strcmp_fallbacks(void);
+
+/**
+ * q_delete_dup_hash() - Delete all nodes whose string appears more than once
+ * anywhere in the queue
+ * @head: header of queue
+ *
+ * Unlike q_delete_dup(), the queue does not need to be sorted. Values are
+ * counted in an open-addressing hash table in one pass, and every copy of a
+ * repeated value is deleted in a second one. The order of the remaining
+ * nodes is preserved.
+ *
+ * Return: true for success, false if list is NULL or empty, or if no table
+ * could be allocated.
+ */
+bool q_delete_dup_hash(struct list_head *head);
+
 /**
  * q_shuffle() - Shuffle elements of queue randomly
  * @head: header of queue
  *
+ * Fisher-Yates over an array of the nodes, so every permutation is equally
+ * likely and the cost is linear in the queue length.
+ *
  * No effect if queue is NULL or empty. If there has only one element, do
  * nothing.
  */
 void q_shuffle(struct list_head *head);
 
+/**
+ * q_save() - Write every queue of a chain to a snapshot file
+ * @chain: header of chain, as q_merge() takes it
+ * @path: file to create or overwrite
+ *
+ * The file holds a header, an index of the distinct strings, the strings
+ * themselves, each prefixed by its length and terminated, and for every
+ * queue in chain order the number of each element's string. Repeated
+ * strings are thus stored once. The format is spelled out in queue.c. The
+ * file goes through a large stdio buffer, in batches of thousands of
+ * elements.
+ *
+ * The snapshot is written to a temporary file next to @path and renamed
+ * over it at the end. An existing file is thus replaced, never rewritten,
+ * and queues still mapped from it by q_map() keep their strings.
+ *
+ * Return: false for allocation failed, an I/O error, or chain or path NULL
+ */
+bool q_save(struct list_head *chain, const char *path);
+
+/**
+ * q_load() - Rebuild the queues of a snapshot file
+ * @path: file written by q_save()
+ * @add_queue: returns a new empty queue, NULL for failure. Called once for
+ *             every queue in the file, in order.
+ * @arg: passed to @add_queue
+ *
+ * Elements are created with q_insert_tail_bulk(), thousands at a time. On
+ * failure the queues already added are left for the caller to free, and
+ * the last of them may be partly filled.
+ *
+ * Return: the number of queues loaded, -1 for allocation failed, an I/O
+ * error or a malformed file
+ */
+int q_load(const char *path,
+           struct list_head *(*add_queue)(void *arg),
+           void *arg);
+
+/**
+ * q_map() - Rebuild the queues of a snapshot file without copying it
+ * @path: file written by q_save()
+ * @add_queue: returns a new empty queue, NULL for failure. Called once for
+ *             every queue in the file, in order.
+ * @arg: passed to @add_queue
+ *
+ * Unlike q_load(), the file is mapped read-only and every element points
+ * its value at the string in the mapping, so no string is copied. Pages
+ * come in from the page cache as they are touched, shared with every other
+ * process mapping the same file. Besides the numbers of the strings, only
+ * the first 8 bytes of each string are read, to check the key stored with
+ * it, and one element is allocated for each number. The elements are
+ * ordinary ones in every other way: moving them around or removing them
+ * copies nothing, and the mapping goes away when the last of them is
+ * released. Their values must not be written to, and the file must not be
+ * truncated while they live. q_save() over the same path is safe, since it
+ * replaces the file instead.
+ *
+ * Failure leaves the queues like q_load() does.
+ *
+ * Return: the number of queues mapped, -1 for allocation failed, an I/O
+ * error or a malformed file, a key not matching its string included
+ */
+int q_map(const char *path,
+          struct list_head *(*add_queue)(void *arg),
+          void *arg);
+
 
 #endif  // LAB0_QUEUE_H
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "pool.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -24,6 +25,9 @@
 /* Value at end of every block */
 #define MAGICFOOTER 0xbeefdead
 
+/* Value at start of every scratch buffer */
+#define MAGICSCRATCH 0xcafebabe
+
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
@@ -42,6 +46,7 @@ typedef struct __block_element {
 
 static block_element_t *allocated = NULL;
 static size_t allocated_count = 0;
+static size_t scratch_count = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
@@ -68,9 +73,9 @@ static bool fail_allocation()
 }
 
 /* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
+ * Signal error if doesn't seem like legitimate block carrying magic
  */
-static block_element_t *find_header(void *p)
+static block_element_t *find_header(void *p, size_t magic)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
@@ -95,7 +100,7 @@ static block_element_t *find_header(void *p)
         }
     }
 
-    if (b->magic_header != MAGICHEADER) {
+    if (b->magic_header != magic) {
         report_event(
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
@@ -115,20 +120,9 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
-/* Implementation of application functions */
-
-void *test_malloc(size_t size)
+/* Allocate a block carrying @magic and link it into the allocated list */
+static void *alloc_block(size_t size, size_t magic)
 {
-    if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to malloc disallowed");
-        return NULL;
-    }
-
-    if (fail_allocation()) {
-        report_event(MSG_WARN, "Malloc returning NULL");
-        return NULL;
-    }
-
     block_element_t *new_block =
         malloc(size + sizeof(block_element_t) + sizeof(size_t));
     if (!new_block) {
@@ -137,7 +131,7 @@ void *test_malloc(size_t size)
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
+    new_block->magic_header = magic;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
     *find_footer(new_block) = MAGICFOOTER;
@@ -156,6 +150,23 @@ void *test_malloc(size_t size)
     return p;
 }
 
+/* Implementation of application functions */
+
+void *test_malloc(size_t size)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to malloc disallowed");
+        return NULL;
+    }
+
+    if (fail_allocation()) {
+        report_event(MSG_WARN, "Malloc returning NULL");
+        return NULL;
+    }
+
+    return alloc_block(size, MAGICHEADER);
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -168,17 +179,10 @@ void *test_calloc(size_t nelem, size_t elsize)
     return ptr;
 }
 
-void test_free(void *p)
+/* Check the block carrying magic, unlink it and give it back */
+static void release_block(void *p, size_t magic)
 {
-    if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to free disallowed");
-        return;
-    }
-
-    if (!p)
-        return;
-
-    block_element_t *b = find_header(p);
+    block_element_t *b = find_header(p, magic);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -205,6 +209,49 @@ void test_free(void *p)
     allocated_count--;
 }
 
+void test_bad_free(void *p)
+{
+    report_event(
+        MSG_ERROR,
+        "Attempted to free unallocated or corrupted block.  Address = %p", p);
+    error_occurred = true;
+}
+
+void test_free(void *p)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+
+    if (!p)
+        return;
+
+    release_block(p, MAGICHEADER);
+}
+
+void *test_scratch_alloc(size_t size)
+{
+    /* Callers have a way around a missing buffer, so let them take it */
+    if (fail_allocation()) {
+        report_event(MSG_WARN, "Scratch allocation returning NULL");
+        return NULL;
+    }
+
+    void *p = alloc_block(size, MAGICSCRATCH);
+    scratch_count++;
+    return p;
+}
+
+void test_scratch_free(void *p)
+{
+    if (!p)
+        return;
+
+    release_block(p, MAGICSCRATCH);
+    scratch_count--;
+}
+
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
@@ -218,6 +265,8 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
+    /* Empty slabs cached by the element pool are not leaks */
+    pool_trim();
     return allocated_count;
 }
 
@@ -236,6 +285,12 @@ void set_cautious_mode(bool cautious)
  */
 void set_noallocate_mode(bool noallocate)
 {
+    /* Scratch buffers must not outlive the operation which requested them */
+    if (!noallocate && scratch_count) {
+        report_event(MSG_ERROR, "%lu scratch buffer(s) were not released",
+                     scratch_count);
+        error_occurred = true;
+    }
     noallocate_mode = noallocate;
 }
 
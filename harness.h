@@ -14,8 +14,22 @@ void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
 char *test_strdup(const char *s);
+
+/* Report an attempt to free something which is not a live block, for the
+ * allocators built on top of test_malloc, such as the element pool
+ */
+void test_bad_free(void *p);
 /* FIXME: provide test_realloc as well */
 
+/* Scratch buffers are temporary working storage for a single operation.
+ * Unlike test_malloc, they may be requested while allocation is otherwise
+ * disallowed, but every one of them has to be released with
+ * test_scratch_free before the operation returns. They fail as often as
+ * test_malloc does, so callers need a way to do without one.
+ */
+void *test_scratch_alloc(size_t size);
+void test_scratch_free(void *p);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
@@ -33,6 +47,8 @@ void set_cautious_mode(bool cautious);
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
+ * Scratch buffers stay available, but leaving the mode with any of them
+ * still outstanding is reported as an error.
  */
 void set_noallocate_mode(bool noallocate);
 
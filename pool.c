@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "harness.h"
+#include "list.h"
+#include "pool.h"
+
+/* Bytes requested from the underlying allocator for every slab */
+#define SLAB_SIZE (16 * 1024)
+
+/* Payload sizes served from slabs, larger requests are allocated directly.
+ * Together with the chunk header every class spans a power of two bytes, so
+ * an element with its inline string occupies exactly one cache line.
+ */
+static const size_t class_size[] = {8, 24, 56, 120, 248};
+#define N_CLASS (sizeof(class_size) / sizeof(class_size[0]))
+
+struct pool_slab;
+
+/* Every chunk is preceded by the address of the slab it was carved from,
+ * or 0 when the chunk was allocated directly, with CHUNK_LIVE set while the
+ * chunk is handed out. Slabs are aligned, so the low bit is always free.
+ */
+typedef struct {
+    uintptr_t slab;
+    unsigned char payload[];
+} pool_chunk_t;
+
+#define CHUNK_LIVE 1
+
+/* Tells a slab apart from whatever a stray pointer would lead to */
+#define SLAB_MAGIC 0x736c6162736c6162
+
+typedef struct {
+    size_t chunk_size;        /* payload plus chunk header */
+    size_t capacity;          /* chunks per slab */
+    struct list_head partial; /* slabs which still have free chunks */
+    struct pool_slab *spare;  /* a completely free slab kept for reuse */
+} pool_class_t;
+
+typedef struct pool_slab {
+    struct list_head list; /* linked in pool_class_t.partial */
+    pool_class_t *cls;     /* size class the chunks belong to */
+    pool_chunk_t *free;    /* recycled chunks, linked through their payload */
+    unsigned char *bump;   /* next chunk never handed out */
+    size_t live;           /* chunks currently handed out */
+    uint64_t magic;        /* SLAB_MAGIC */
+    unsigned char data[];  /* chunks */
+} pool_slab_t;
+
+static pool_class_t classes[N_CLASS];
+static bool initialized = false;
+
+static void pool_init()
+{
+    for (size_t i = 0; i < N_CLASS; i++) {
+        pool_class_t *cls = &classes[i];
+        cls->chunk_size = sizeof(pool_chunk_t) + class_size[i];
+        cls->capacity = (SLAB_SIZE - sizeof(pool_slab_t)) / cls->chunk_size;
+        INIT_LIST_HEAD(&cls->partial);
+        cls->spare = NULL;
+    }
+    initialized = true;
+}
+
+static pool_class_t *find_class(size_t size)
+{
+    for (size_t i = 0; i < N_CLASS; i++) {
+        if (size <= class_size[i])
+            return &classes[i];
+    }
+    return NULL;
+}
+
+static pool_slab_t *slab_new(pool_class_t *cls)
+{
+    pool_slab_t *slab = cls->spare;
+    if (slab) {
+        cls->spare = NULL;
+    } else {
+        slab = malloc(SLAB_SIZE);
+        if (!slab)
+            return NULL;
+    }
+
+    slab->cls = cls;
+    slab->free = NULL;
+    slab->bump = slab->data;
+    slab->live = 0;
+    slab->magic = SLAB_MAGIC;
+    list_add(&slab->list, &cls->partial);
+    return slab;
+}
+
+static void slab_release(pool_slab_t *slab)
+{
+    pool_class_t *cls = slab->cls;
+
+    list_del(&slab->list);
+    if (!cls->spare)
+        cls->spare = slab;
+    else
+        free(slab);
+}
+
+void *pool_alloc(size_t size)
+{
+    if (!initialized)
+        pool_init();
+
+    pool_class_t *cls = find_class(size);
+    if (!cls) {
+        pool_chunk_t *chunk = malloc(sizeof(pool_chunk_t) + size);
+        if (!chunk)
+            return NULL;
+        chunk->slab = CHUNK_LIVE;
+        return chunk->payload;
+    }
+
+    pool_slab_t *slab;
+    if (list_empty(&cls->partial)) {
+        slab = slab_new(cls);
+        if (!slab)
+            return NULL;
+    } else {
+        slab = list_first_entry(&cls->partial, pool_slab_t, list);
+    }
+
+    pool_chunk_t *chunk = slab->free;
+    if (chunk) {
+        slab->free = *(pool_chunk_t **) chunk->payload;
+    } else {
+        chunk = (pool_chunk_t *) slab->bump;
+        slab->bump += cls->chunk_size;
+    }
+    chunk->slab = (uintptr_t) slab | CHUNK_LIVE;
+
+    /* A full slab leaves the partial list until one of its chunks returns */
+    if (++slab->live == cls->capacity)
+        list_del_init(&slab->list);
+
+    return chunk->payload;
+}
+
+char *pool_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *new = pool_alloc(len);
+    if (!new)
+        return NULL;
+
+    return memcpy(new, s, len);
+}
+
+void pool_free(void *p)
+{
+    if (!p)
+        return;
+
+    pool_chunk_t *chunk =
+        (pool_chunk_t *) ((uintptr_t) p - offsetof(pool_chunk_t, payload));
+    /* Freeing twice, or freeing what the pool never handed out, is
+     * reported like test_free() does for its own blocks
+     */
+    pool_slab_t *slab = (pool_slab_t *) (chunk->slab & ~CHUNK_LIVE);
+    if (!(chunk->slab & CHUNK_LIVE) || (slab && slab->magic != SLAB_MAGIC)) {
+        test_bad_free(p);
+        return;
+    }
+    chunk->slab &= ~CHUNK_LIVE;
+    if (!slab) {
+        free(chunk);
+        return;
+    }
+
+    pool_class_t *cls = slab->cls;
+    if (slab->live == cls->capacity)
+        list_add(&slab->list, &cls->partial);
+
+    *(pool_chunk_t **) chunk->payload = slab->free;
+    slab->free = chunk;
+    if (--slab->live == 0)
+        slab_release(slab);
+}
+
+void pool_trim(void)
+{
+    if (!initialized)
+        return;
+
+    for (size_t i = 0; i < N_CLASS; i++) {
+        if (!classes[i].spare)
+            continue;
+        free(classes[i].spare);
+        classes[i].spare = NULL;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef LAB0_POOL_H
+#define LAB0_POOL_H
+
+#include <stddef.h>
+
+/* Slab allocator for queue elements and their strings.
+ *
+ * Requests are rounded up to one of a few size classes. Each class carves
+ * fixed-size chunks out of slabs and recycles them through per-slab free
+ * lists, so the underlying allocator (test_malloc in qtest) is only visited
+ * once per slab rather than once per element. A slab is handed back as soon
+ * as its last chunk is freed, which keeps the harness leak checks accurate.
+ */
+
+/**
+ * pool_alloc() - Allocate a chunk of at least @size bytes
+ * @size: requested payload size
+ *
+ * Sizes beyond the largest class fall back to a dedicated allocation.
+ *
+ * Return: pointer to the payload, NULL for allocation failed
+ */
+void *pool_alloc(size_t size);
+
+/**
+ * pool_strdup() - Duplicate a string into pool memory
+ * @s: the string to copy
+ *
+ * Return: the copy, NULL for allocation failed
+ */
+char *pool_strdup(const char *s);
+
+/**
+ * pool_free() - Give a chunk obtained from pool_alloc() back
+ * @p: the chunk, no effect if NULL
+ *
+ * Freeing a chunk twice, or a pointer the pool never handed out, is
+ * reported as an error through the harness and otherwise ignored.
+ */
+void pool_free(void *p);
+
+/**
+ * pool_trim() - Release the empty slabs kept around for reuse
+ *
+ * Called by the harness before it counts outstanding blocks.
+ */
+void pool_trim(void);
+
+#endif /* LAB0_POOL_H */
@@ -48,6 +48,8 @@ extern int show_entropy;
 #include "custom.h"
 // clang-format on
 
+#include "cbench.h"
+
 #include "console.h"
 #include "report.h"
 
@@ -77,10 +79,33 @@ static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Which algorithm does the sort command use */
+enum { SORT_MERGE, SORT_LIST, SORT_RADIX, SORT_PARALLEL, SORT_ARRAY };
+static int sort_engine = SORT_MERGE;
+
+/* Names of the queue backends, as accepted by -b */
+static const char *const backend_names[Q_BACKEND_COUNT] = {
+    [Q_BACKEND_LIST] = "list",
+    [Q_BACKEND_CHUNK] = "chunk",
+    [Q_BACKEND_RING] = "ring",
+};
+
+/* Does the merge command use q_parallel_merge */
+static int merge_parallel = 0;
+
+/* How many threads may the parallel engines use */
+static int thread_count = 4;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 
+/* How many random strings are handed to one bulk insertion */
+#define RAND_BATCH 1024
+
+/* Size of the packed buffer used by bulk removal */
+#define DRAIN_BUFSIZE 4096
+
 /* Forward declarations */
 static bool q_show(int vlevel);
 
@@ -161,6 +186,90 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    /* Not timed, the speed of the disk is none of the queue's business */
+    bool ok = false;
+    if (exception_setup(false))
+        ok = q_save(&chain.head, argv[1]);
+    exception_cancel();
+
+    if (!ok) {
+        report(1, "ERROR: Could not save the queues to %s", argv[1]);
+        return false;
+    }
+    report(2, "Saved %d queues to %s", chain.size, argv[1]);
+    return !error_check();
+}
+
+/* Append a new empty queue to the chain, for q_load() to fill */
+static struct list_head *add_loaded_queue(void *arg)
+{
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    if (!qctx)
+        return NULL;
+
+    qctx->q = q_new();
+    if (!qctx->q) {
+        free(qctx);
+        return NULL;
+    }
+    list_add_tail(&qctx->chain, &chain.head);
+    qctx->size = 0;
+    qctx->id = chain.size++;
+    current = qctx;
+    return qctx->q;
+}
+
+/* Add the queues of a snapshot file to the chain with @restore */
+static bool restore_queues(int argc,
+                           char *argv[],
+                           int (*restore)(const char *path,
+                                          struct list_head *(*)(void *),
+                                          void *),
+                           const char *done)
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int first = chain.size, loaded = -1;
+    if (exception_setup(false))
+        loaded = restore(argv[1], add_loaded_queue, NULL);
+    exception_cancel();
+
+    /* Whatever made it into the chain counts, even after a failure */
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if (ctx->id >= first)
+            ctx->size = q_size(ctx->q);
+    }
+
+    if (loaded < 0) {
+        report(1, "ERROR: Could not %s the queues from %s", argv[0], argv[1]);
+        return false;
+    }
+    report(2, "%s %d queues from %s", done, loaded, argv[1]);
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    return restore_queues(argc, argv, q_load, "Loaded");
+}
+
+static bool do_map(int argc, char *argv[])
+{
+    return restore_queues(argc, argv, q_map, "Mapped");
+}
+
 /* TODO: Add a buf_size check of if the buf_size may be less
  * than MIN_RANDSTR_LEN.
  */
@@ -176,6 +285,67 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Insert reps elements with the bulk API, at the tail if tail is set.
+ * Elements are copies of inserts, or fresh random strings if need_rand.
+ */
+static bool insert_bulk(bool tail, char *inserts, bool need_rand, int reps)
+{
+    char randstr_buf[RAND_BATCH][MAX_RANDSTR_LEN];
+    char *sv[RAND_BATCH];
+    bool ok = true;
+
+    sv[0] = inserts;
+    for (int done = 0; ok && done < reps;) {
+        int n = reps - done, nsv = 1;
+        if (need_rand) {
+            n = n < RAND_BATCH ? n : RAND_BATCH;
+            for (nsv = 0; nsv < n; nsv++) {
+                fill_rand_string(randstr_buf[nsv], MAX_RANDSTR_LEN);
+                sv[nsv] = randstr_buf[nsv];
+            }
+        }
+
+        bool rval = tail ? q_insert_tail_bulk(current->q, sv, nsv, n)
+                         : q_insert_head_bulk(current->q, sv, nsv, n);
+        if (rval) {
+            current->size += n;
+            /* The element inserted last is found at the end we grew */
+            q_iter_t it;
+            element_t *last = tail ? q_iter_last(current->q, &it)
+                                   : q_iter_first(current->q, &it);
+            element_t *prev = tail ? q_iter_prev(&it) : q_iter_next(&it);
+            char *cur_inserts = last->value;
+            char *prev_inserts = n > 1 ? prev->value : NULL;
+            if (!cur_inserts) {
+                report(1, "ERROR: Failed to save copy of string in queue");
+                ok = false;
+            } else if (cur_inserts == sv[(n - 1) % nsv]) {
+                report(1,
+                       "ERROR: Need to allocate and copy string for new "
+                       "queue element");
+                ok = false;
+            } else if (cur_inserts == prev_inserts) {
+                report(1,
+                       "ERROR: Need to allocate separate string for each "
+                       "queue element");
+                ok = false;
+            }
+        } else {
+            fail_count++;
+            if (fail_count < fail_limit)
+                report(2, "Insertion of %s failed", inserts);
+            else {
+                report(1, "ERROR: Insertion of %s failed (%d failures total)",
+                       inserts, fail_count);
+                ok = false;
+            }
+        }
+        ok = ok && !error_check();
+        done += n;
+    }
+    return ok;
+}
+
 /* insert head */
 static bool do_ih(int argc, char *argv[])
 {
@@ -220,15 +390,18 @@ static bool do_ih(int argc, char *argv[])
         report(3, "Warning: Calling insert head on null queue");
     error_check();
 
-    if (current && exception_setup(true)) {
+    if (reps > 1) {
+        if (current && exception_setup(true))
+            ok = insert_bulk(false, argv[1], need_rand, reps);
+    } else if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = q_insert_head(current->q, inserts);
             if (rval) {
                 current->size++;
-                char *cur_inserts =
-                    list_entry(current->q->next, element_t, list)->value;
+                q_iter_t it;
+                char *cur_inserts = q_iter_first(current->q, &it)->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
@@ -309,15 +482,18 @@ static bool do_it(int argc, char *argv[])
         report(3, "Warning: Calling insert tail on null queue");
     error_check();
 
-    if (current && exception_setup(true)) {
+    if (reps > 1) {
+        if (current && exception_setup(true))
+            ok = insert_bulk(true, argv[1], need_rand, reps);
+    } else if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = q_insert_tail(current->q, inserts);
             if (rval) {
                 current->size++;
-                char *cur_inserts =
-                    list_entry(current->q->prev, element_t, list)->value;
+                q_iter_t it;
+                char *cur_inserts = q_iter_last(current->q, &it)->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
@@ -341,6 +517,198 @@ static bool do_it(int argc, char *argv[])
     return ok;
 }
 
+/* insert in order */
+static bool do_is(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    int reps = 1;
+    bool ok = true, need_rand = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    if (argc == 3) {
+        if (!get_int(argv[2], &reps)) {
+            report(1, "Invalid number of insertions '%s'", argv[2]);
+            return false;
+        }
+    }
+
+    if (!strcmp(inserts, "RAND")) {
+        need_rand = true;
+        inserts = randstr_buf;
+    }
+
+    if (!current || !current->q)
+        report(3, "Warning: Calling insert sorted on null queue");
+    error_check();
+
+    if (current && exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (q_insert_sorted(current->q, inserts)) {
+                current->size++;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (ok && current && current->size) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; item && (next_item = q_iter_next(&it)); item = next_item) {
+            if (strcmp(item->value, next_item->value) > 0) {
+                report(1, "ERROR: Not sorted in ascending order after "
+                          "inserting in order");
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    q_show(3);
+    return ok;
+}
+
+static bool do_index(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    bool enable = argc == 1 || !strcmp(argv[1], "on");
+    if (argc == 2 && !enable && strcmp(argv[1], "off")) {
+        report(1, "Invalid choice '%s', expected on or off", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_set_index(current->q, enable);
+    exception_cancel();
+
+    if (!ok)
+        report(1, "Cannot %s the index of this queue",
+               enable ? "enable" : "disable");
+    return ok && !error_check();
+}
+
+/* Look @s up in the current queue the slow way: return the number of
+ * elements less than it and store the first one equal to it, if any, in
+ * @found
+ */
+static int scan_value(const char *s, element_t **found)
+{
+    q_iter_t it;
+    element_t *e = q_iter_first(current->q, &it);
+    int rank = 0;
+
+    for (; e && strcmp(e->value, s) < 0; e = q_iter_next(&it))
+        rank++;
+    *found = e && !strcmp(e->value, s) ? e : NULL;
+    return rank;
+}
+
+static bool do_find(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    element_t *e = NULL;
+    int rank = 0;
+    if (exception_setup(true)) {
+        e = q_find(current->q, argv[1]);
+        rank = q_rank(current->q, argv[1]);
+    }
+    exception_cancel();
+
+    element_t *expect;
+    int expect_rank = scan_value(argv[1], &expect);
+    bool ok = true;
+    if (e != expect) {
+        report(1, "ERROR: Found %s where a scan of the queue finds %s",
+               e ? e->value : "nothing", expect ? expect->value : "nothing");
+        ok = false;
+    } else if (rank != expect_rank) {
+        report(1, "ERROR: Ranked %s at %d, but correct position is %d",
+               argv[1], rank, expect_rank);
+        ok = false;
+    } else if (e) {
+        report(2, "Found %s at position %d", argv[1], rank);
+    } else {
+        report(2, "%s not found, would go at position %d", argv[1], rank);
+    }
+    return ok && !error_check();
+}
+
+static bool do_dv(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    element_t *expect;
+    scan_value(argv[1], &expect);
+
+    bool deleted = false;
+    if (exception_setup(true))
+        deleted = q_delete_value(current->q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    if (deleted)
+        current->size--;
+    if (deleted != !!expect) {
+        report(1, "ERROR: Deletion of %s %s, but the queue %s it", argv[1],
+               deleted ? "succeeded" : "failed",
+               expect ? "holds" : "does not hold");
+        ok = false;
+    } else if (deleted) {
+        report(2, "Deleted %s", argv[1]);
+    } else {
+        report(2, "%s not found", argv[1]);
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_remove(int option, int argc, char *argv[])
 {
     // option 0 is for remove head; option 1 is for remove tail
@@ -469,19 +837,156 @@ static inline bool do_rt(int argc, char *argv[])
     return do_remove(1, argc, argv);
 }
 
+static bool do_drain(int option, int argc, char *argv[])
+{
+    // option 0 is for remove head; option 1 is for remove tail
+
+    int n;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &n) || n < 0) {
+        report(1, "Invalid number of removals '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->size)
+        report(3, "Warning: Calling bulk remove on empty queue");
+    error_check();
+
+    if (!current)
+        return !error_check();
+
+    /* Remember what should come out before anything is removed */
+    int expected_cnt = n < current->size ? n : current->size;
+    char **expected = calloc(expected_cnt + 1, sizeof(char *));
+    char *removes = malloc(DRAIN_BUFSIZE + STRINGPAD);
+    size_t *offsets = malloc(sizeof(size_t) * DRAIN_BUFSIZE);
+    bool ok = expected && removes && offsets;
+
+    q_iter_t it;
+    element_t *cur = option ? q_iter_last(current->q, &it)
+                            : q_iter_first(current->q, &it);
+    for (int i = 0; ok && i < expected_cnt; i++) {
+        expected[i] = strdup(cur->value);
+        ok = expected[i] != NULL;
+        cur = option ? q_iter_prev(&it) : q_iter_next(&it);
+    }
+    if (!ok) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        goto out;
+    }
+
+    int removed = 0;
+    while (ok && removed < n) {
+        int k = 0, batch = n - removed;
+        if (batch > DRAIN_BUFSIZE)
+            batch = DRAIN_BUFSIZE;
+
+        memset(removes, 'X', DRAIN_BUFSIZE + STRINGPAD);
+        if (exception_setup(true))
+            k = option ? q_remove_tail_bulk(current->q, batch, removes,
+                                            DRAIN_BUFSIZE, offsets)
+                       : q_remove_head_bulk(current->q, batch, removes,
+                                            DRAIN_BUFSIZE, offsets);
+        exception_cancel();
+        if (k == 0)
+            break;
+
+        /* Padding behind the packed buffer must be left untouched */
+        for (int i = DRAIN_BUFSIZE; i < DRAIN_BUFSIZE + STRINGPAD; i++) {
+            if (removes[i] != 'X') {
+                report(1,
+                       "ERROR: copying of strings in bulk remove overflowed "
+                       "destination buffer.");
+                ok = false;
+                break;
+            }
+        }
+
+        for (int i = 0; ok && i < k; i++) {
+            char *got = removes + offsets[i];
+            if (removed + i >= expected_cnt) {
+                report(1, "ERROR: Removed more elements than queue held");
+                ok = false;
+            } else if (strncmp(got, expected[removed + i],
+                               DRAIN_BUFSIZE - 1)) {
+                report(1, "ERROR: Removed value %s != expected value %s", got,
+                       expected[removed + i]);
+                ok = false;
+            }
+        }
+        removed += k;
+    }
+
+    current->size -= removed;
+    if (ok && removed != expected_cnt) {
+        report(1, "ERROR: Removed %d elements, but %d were expected", removed,
+               expected_cnt);
+        ok = false;
+    }
+    if (ok)
+        report(2, "Removed %d elements from queue", removed);
+
+    q_show(3);
+
+out:
+    for (int i = 0; expected && i < expected_cnt; i++)
+        free(expected[i]);
+    free(expected);
+    free(removes);
+    free(offsets);
+    return ok && !error_check();
+}
+
+static inline bool do_rhb(int argc, char *argv[])
+{
+    return do_drain(0, argc, argv);
+}
+
+static inline bool do_rtb(int argc, char *argv[])
+{
+    return do_drain(1, argc, argv);
+}
+
+static int cmp_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Does @s occur more than once in the sorted array @ref of @n strings */
+static bool repeated_in(char **ref, size_t n, const char *s)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(ref[mid], s) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo + 1 < n && strcmp(ref[lo + 1], s) == 0;
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    bool hash = argc == 2 && strcmp(argv[1], "hash") == 0;
+    if (argc != 1 && !hash) {
+        report(1, "%s takes no arguments other than 'hash'", argv[0]);
         return false;
     }
 
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
+    q_iter_t it;
+    size_t n = 0;
 
     // Copy current->q to l_copy
-    if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
+    if (current->q && q_size(current->q)) {
+        for (item = q_iter_first(current->q, &it); item;
+             item = q_iter_next(&it)) {
             size_t slen;
             tmp = malloc(sizeof(element_t));
             if (!tmp)
@@ -495,9 +1000,28 @@ static bool do_dedup(int argc, char *argv[])
             }
             memcpy(tmp->value, item->value, slen);
             list_add_tail(&tmp->list, &l_copy);
+            n++;
         }
         // Return false if the loop does not leave properly
-        if (&item->list != current->q) {
+        if (item) {
+            list_for_each_entry_safe (item, tmp, &l_copy, list) {
+                free(item->value);
+                free(item);
+            }
+            report(1,
+                   "INTERNAL ERROR.  Could not allocate space for "
+                   "duplicate checking");
+            return false;
+        }
+    }
+
+    /* The hash mode accepts unsorted input, so which values repeat is
+     * decided against a sorted copy instead of the neighbours.
+     */
+    char **ref = NULL;
+    if (hash && n) {
+        ref = malloc(n * sizeof(char *));
+        if (!ref) {
             list_for_each_entry_safe (item, tmp, &l_copy, list) {
                 free(item->value);
                 free(item);
@@ -507,49 +1031,69 @@ static bool do_dedup(int argc, char *argv[])
                    "duplicate checking");
             return false;
         }
+        size_t i = 0;
+        list_for_each_entry (item, &l_copy, list)
+            ref[i++] = item->value;
+        qsort(ref, n, sizeof(char *), cmp_strings);
     }
 
     bool ok = true;
     if (exception_setup(true))
-        ok = q_delete_dup(current->q);
+        ok = hash ? q_delete_dup_hash(current->q) : q_delete_dup(current->q);
     exception_cancel();
 
     if (!ok) {
+        free(ref);
         list_for_each_entry_safe (item, tmp, &l_copy, list) {
             free(item->value);
             free(item);
         }
-        report(1, "ERROR: Calling delete duplicate on null queue");
+        /* The hash mode fails on a queue with elements only for want of
+         * memory for its table, like an insertion may
+         */
+        if (!hash || !n) {
+            report(1, "ERROR: Calling delete duplicate on null queue");
+            return false;
+        }
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Deletion of duplicates failed");
+            q_show(3);
+            return !error_check();
+        }
+        report(1, "ERROR: Deletion of duplicates failed (%d failures total)",
+               fail_count);
         return false;
     }
 
-    struct list_head *l_tmp = current->q->next;
+    element_t *kept = q_iter_first(current->q, &it);
     bool is_this_dup = false;
     // Compare between new list and old one
     list_for_each_entry (item, &l_copy, list) {
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
-            item->list.next != &l_copy &&
+            !hash && item->list.next != &l_copy &&
             strcmp(list_entry(item->list.next, element_t, list)->value,
                    item->value) == 0;
+        if (hash)
+            is_this_dup = repeated_in(ref, n, item->value);
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
-        } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
+        } else if (kept && strcmp(kept->value, item->value) == 0)
+            kept = q_iter_next(&it);
         else
             ok = false;
         is_this_dup = is_next_dup;
     }
     // All elements in new list should be traversed
-    ok = ok && l_tmp == current->q;
+    ok = ok && !kept;
     if (!ok)
         report(1,
                "ERROR: Duplicate strings are in queue or distinct strings are "
                "not in queue");
 
+    free(ref);
     list_for_each_entry_safe (item, tmp, &l_copy, list) {
         free(item->value);
         free(item);
@@ -649,6 +1193,27 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static void sort_queue(struct list_head *head)
+{
+    switch (sort_engine) {
+    case SORT_LIST:
+        q_list_sort(head);
+        break;
+    case SORT_RADIX:
+        q_radix_sort(head);
+        break;
+    case SORT_PARALLEL:
+        q_parallel_sort(head, thread_count);
+        break;
+    case SORT_ARRAY:
+        q_array_sort(head);
+        break;
+    default:
+        q_sort(head);
+        break;
+    }
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -667,21 +1232,21 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    q_reset_strcmp_fallbacks();
     set_noallocate_mode(true);
     if (current && exception_setup(true))
-        q_sort(current->q);
+        sort_queue(current->q);
     exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; item && --cnt && (next_item = q_iter_next(&it));
+             item = next_item) {
             /* Ensure each element in ascending order */
             /* FIXME: add an option to specify sorting order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
             if (strcmp(item->value, next_item->value) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
@@ -690,6 +1255,7 @@ bool do_sort(int argc, char *argv[])
         }
     }
 
+    report(3, "Comparisons decided by strcmp: %zu", q_strcmp_fallbacks());
     q_show(3);
     return ok && !error_check();
 }
@@ -712,6 +1278,7 @@ bool do_list_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    q_reset_strcmp_fallbacks();
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         q_list_sort(current->q);
@@ -720,13 +1287,12 @@ bool do_list_sort(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; item && --cnt && (next_item = q_iter_next(&it));
+             item = next_item) {
             /* Ensure each element in ascending order */
             /* FIXME: add an option to specify sorting order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
             if (strcmp(item->value, next_item->value) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
@@ -735,10 +1301,35 @@ bool do_list_sort(int argc, char *argv[])
         }
     }
 
+    report(3, "Comparisons decided by strcmp: %zu", q_strcmp_fallbacks());
     q_show(3);
     return ok && !error_check();
 }
 
+/* Element at @pos of the current queue, found by walking it */
+static element_t *walk_to(int pos)
+{
+    q_iter_t it;
+    element_t *e = pos >= 0 ? q_iter_first(current->q, &it) : NULL;
+
+    while (e && pos-- > 0)
+        e = q_iter_next(&it);
+    return e;
+}
+
+/* After deleting the element at @pos, its neighbours @before and @after
+ * have to be next to each other
+ */
+static bool check_deleted(int pos, element_t *before, element_t *after)
+{
+    if (walk_to(pos - 1) != before || walk_to(pos) != after) {
+        report(1, "ERROR: Deleted some element other than the one at %d",
+               pos);
+        return false;
+    }
+    return true;
+}
+
 static bool do_dm(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -750,16 +1341,214 @@ static bool do_dm(int argc, char *argv[])
         report(3, "Warning: Try to access null queue");
     error_check();
 
+    int mid = q_size(current->q) / 2;
+    element_t *before = NULL, *after = NULL;
+    if (current->q) {
+        before = walk_to(mid - 1);
+        after = walk_to(mid + 1);
+    }
+
     bool ok = true;
     if (exception_setup(true))
         ok = q_delete_mid(current->q);
     exception_cancel();
 
-    current->size--;
+    if (ok) {
+        current->size--;
+        ok = check_deleted(mid, before, after);
+    }
     q_show(3);
     return ok && !error_check();
 }
 
+static bool do_get(int argc, char *argv[])
+{
+    int pos;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &pos)) {
+        report(1, "Invalid position '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    element_t *e = NULL;
+    if (exception_setup(true))
+        e = q_get(current->q, pos);
+    exception_cancel();
+
+    element_t *expect = walk_to(pos);
+    if (e != expect) {
+        report(1, "ERROR: Got %s at position %d, but correct value is %s",
+               e ? e->value : "nothing", pos,
+               expect ? expect->value : "nothing");
+        return false;
+    }
+    if (e)
+        report(2, "Element at position %d is %s", pos, e->value);
+    else
+        report(2, "No element at position %d", pos);
+    return !error_check();
+}
+
+static bool do_ia(int argc, char *argv[])
+{
+    int pos;
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &pos)) {
+        report(1, "Invalid position '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    /* The new element goes between these two */
+    element_t *before = walk_to(pos - 1), *after = walk_to(pos);
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_insert_at(current->q, pos, argv[2]);
+    exception_cancel();
+
+    if (!ok) {
+        report(2, "Insertion of %s at position %d failed", argv[2], pos);
+    } else {
+        current->size++;
+        element_t *e = walk_to(pos);
+        if (!e || strcmp(e->value, argv[2]) || walk_to(pos - 1) != before ||
+            walk_to(pos + 1) != after) {
+            report(1, "ERROR: %s did not end up at position %d", argv[2],
+                   pos);
+            return false;
+        }
+    }
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_da(int argc, char *argv[])
+{
+    int pos;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &pos)) {
+        report(1, "Invalid position '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    element_t *before = walk_to(pos - 1), *after = walk_to(pos + 1);
+    bool expect = pos >= 0 && walk_to(pos);
+
+    bool deleted = false;
+    if (exception_setup(true))
+        deleted = q_delete_at(current->q, pos);
+    exception_cancel();
+
+    bool ok = true;
+    if (deleted)
+        current->size--;
+    if (deleted != expect) {
+        report(1, "ERROR: Deletion at position %d %s, but the queue %s it",
+               pos, deleted ? "succeeded" : "failed",
+               expect ? "reaches" : "does not reach");
+        ok = false;
+    } else if (deleted) {
+        ok = check_deleted(pos, before, after);
+    } else {
+        report(2, "No element at position %d", pos);
+    }
+    q_show(3);
+    return ok && !error_check();
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Time random positional operations on private queues of growing sizes,
+ * with and without the index, to show how their cost scales
+ */
+static bool do_posbench(int argc, char *argv[])
+{
+    int max = 1 << 18, ops = 1000;
+
+    if (argc > 3 || (argc >= 2 && (!get_int(argv[1], &max) || max < 1)) ||
+        (argc == 3 && (!get_int(argv[2], &ops) || ops < 1))) {
+        report(1, "%s takes an optional positive maximum size and number of "
+                  "operations",
+               argv[0]);
+        return false;
+    }
+    error_check();
+
+    char *s = "posbench";
+    for (int n = 1024; n <= max; n *= 4) {
+        for (int indexed = 0; indexed <= 1; indexed++) {
+            struct list_head *q = q_new();
+            if (!q || !q_insert_tail_bulk(q, &s, 1, n)) {
+                q_free(q);
+                report(1, "ERROR: Could not build a queue of %d elements", n);
+                return false;
+            }
+            if (indexed && !q_set_index(q, true)) {
+                q_free(q);
+                break;
+            }
+
+            /* Leave building the index out of the timing */
+            q_get(q, 0);
+
+            double start = now_ns();
+            for (int i = 0; i < ops; i++)
+                q_get(q, rand() % n);
+            double get = (now_ns() - start) / ops;
+
+            bool ok = true;
+            start = now_ns();
+            for (int i = 0; ok && i < ops; i++) {
+                ok = q_insert_at(q, rand() % (n + 1), s) &&
+                     q_delete_at(q, rand() % (n + 1));
+            }
+            double update = (now_ns() - start) / ops;
+            q_free(q);
+            if (!ok) {
+                report(1, "ERROR: Positional insertion or deletion failed");
+                return false;
+            }
+
+            report(3, "%8d elements, %s index: get %.0f ns, insert and "
+                      "delete %.0f ns",
+                   n, indexed ? "with" : "without", get, update);
+        }
+    }
+    return !error_check();
+}
+
 static bool do_swap(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -807,11 +1596,10 @@ static bool do_descend(int argc, char *argv[])
 
     cnt = current->size;
     if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; item && --cnt && (next_item = q_iter_next(&it));
+             item = next_item) {
             if (strcmp(item->value, next_item->value) < 0) {
                 report(1,
                        "ERROR: There is at least on nodes did not follow the "
@@ -867,14 +1655,25 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    /* Backends with fixed storage cannot grow the first queue while merging */
+    int total = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain)
+        total += ctx->size;
+    ctx = list_first_entry(&chain.head, queue_contex_t, chain);
+    if (!q_reserve(ctx->q, total))
+        report(3, "Warning: Could not make room for every queue to merge");
+
     int len = 0;
+    q_reset_strcmp_fallbacks();
     set_noallocate_mode(true);
     if (current && exception_setup(true))
-        len = q_merge(&chain.head);
+        len = merge_parallel ? q_parallel_merge(&chain.head, thread_count)
+                             : q_merge(&chain.head);
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -893,12 +1692,11 @@ static bool do_merge(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; item && --len && (next_item = q_iter_next(&it));
+             item = next_item) {
             /* Ensure each element in ascending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
             if (strcmp(item->value, next_item->value) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
@@ -910,10 +1708,117 @@ static bool do_merge(int argc, char *argv[])
         }
     }
 
+    report(3, "Comparisons decided by strcmp: %zu", q_strcmp_fallbacks());
     q_show(3);
     return ok && !error_check();
 }
 
+/* Threads on each side of the concurrent queue benchmarks */
+static int bench_threads(void)
+{
+    if (thread_count < 1)
+        return 1;
+    return thread_count < MAX_BENCH_THREADS ? thread_count : MAX_BENCH_THREADS;
+}
+
+static bool do_mpmc(int argc, char *argv[])
+{
+    static const char *const names[] = {"lock-free", "mutex"};
+    int n = 100000;
+
+    if (argc > 2 || (argc == 2 && (!get_int(argv[1], &n) || n < 1))) {
+        report(1, "%s takes an optional positive number of elements",
+               argv[0]);
+        return false;
+    }
+    error_check();
+
+    int threads = bench_threads();
+    for (int locked = 0; locked <= 1; locked++) {
+        bench_result_t res;
+        if (!bench_mpmc(n, threads, threads, locked, &res)) {
+            report(1, "ERROR: Could not run the %s queue", names[locked]);
+            return false;
+        }
+
+        report(3, "%s: %d producers, %d consumers, %d elements in %.3f s "
+                  "(%.2f M/s)",
+               names[locked], threads, threads, n, res.seconds,
+               n / res.seconds / 1e6);
+        if (res.errors) {
+            report(1, "ERROR: %zu elements lost, repeated or out of order",
+                   res.errors);
+            return false;
+        }
+    }
+    return !error_check();
+}
+
+static bool do_bqueue(int argc, char *argv[])
+{
+    int n = 100000, capacity = 0;
+
+    if (argc > 3 || (argc >= 2 && (!get_int(argv[1], &n) || n < 1)) ||
+        (argc == 3 && (!get_int(argv[2], &capacity) || capacity < 0))) {
+        report(1, "%s takes an optional positive number of elements and "
+                  "capacity",
+               argv[0]);
+        return false;
+    }
+    error_check();
+
+    int threads = bench_threads();
+    bench_result_t res;
+    bq_stats_t stats;
+    if (!bench_blocking(n, threads, threads, capacity, &res, &stats)) {
+        report(1, "ERROR: Could not run the blocking queue");
+        return false;
+    }
+
+    report(3, "blocking: %d producers, %d consumers, %d elements in %.3f s "
+              "(%.2f M/s)",
+           threads, threads, n, res.seconds, n / res.seconds / 1e6);
+    report(3, "waits: %zu, spurious wakeups: %zu, timeouts: %zu, "
+              "time blocked: %.3f s",
+           stats.waits, stats.spurious, stats.timeouts, stats.wait_seconds);
+    if (res.errors) {
+        report(1, "ERROR: %zu elements lost, repeated or out of order",
+               res.errors);
+        return false;
+    }
+    return !error_check();
+}
+
+static bool do_spsc(int argc, char *argv[])
+{
+    int n = 100000, batch = 32;
+
+    if (argc > 3 || (argc >= 2 && (!get_int(argv[1], &n) || n < 1)) ||
+        (argc == 3 && (!get_int(argv[2], &batch) || batch < 1))) {
+        report(1, "%s takes an optional positive number of elements and "
+                  "batch size",
+               argv[0]);
+        return false;
+    }
+    error_check();
+
+    bench_result_t res;
+    if (!bench_spsc(n, batch, &res)) {
+        report(1, "ERROR: Could not run the single-producer queue");
+        return false;
+    }
+
+    report(3, "spsc: %d elements in batches of %d in %.3f s (%.2f M/s), "
+              "latency %.2f us average, %.2f us max",
+           n, batch, res.seconds, n / res.seconds / 1e6, res.latency * 1e6,
+           res.latency_max * 1e6);
+    if (res.errors) {
+        report(1, "ERROR: %zu elements out of order", res.errors);
+        return false;
+    }
+    return !error_check();
+}
+
 static bool is_circular()
 {
     struct list_head *cur = current->q->next;
@@ -951,12 +1856,12 @@ static bool q_show(int vlevel)
 
     report_noreturn(vlevel, "l = [");
 
-    struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    q_iter_t it;
+    element_t *e = NULL;
 
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < current->size) {
-            element_t *e = list_entry(cur, element_t, list);
+        e = q_iter_first(current->q, &it);
+        while (ok && e && cnt < current->size) {
             if (cnt < BIG_LIST_SIZE) {
                 report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
                 if (show_entropy) {
@@ -966,7 +1871,7 @@ static bool q_show(int vlevel)
                 }
             }
             cnt++;
-            cur = cur->next;
+            e = q_iter_next(&it);
             ok = ok && !error_check();
         }
     }
@@ -977,7 +1882,7 @@ static bool q_show(int vlevel)
         return false;
     }
 
-    if (cur == ori) {
+    if (!e) {
         if (cnt <= BIG_LIST_SIZE)
             report(vlevel, "]");
         else
@@ -1056,6 +1961,10 @@ static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
     ADD_COMMAND(free, "Delete queue", "");
+    ADD_COMMAND(save, "Write every queue to a snapshot file", "file");
+    ADD_COMMAND(load, "Append the queues saved in a snapshot file", "file");
+    ADD_COMMAND(map, "Append the queues of a snapshot file, mapped in place",
+                "file");
     ADD_COMMAND(prev, "Switch to previous queue", "");
     ADD_COMMAND(next, "Switch to next queue", "");
     ADD_COMMAND(ih,
@@ -1066,6 +1975,21 @@ static void console_init()
                 "Insert string str at tail of queue n times. Generate random "
                 "string(s) if str equals RAND. (default: n == 1)",
                 "str [n]");
+    ADD_COMMAND(is,
+                "Insert string str in order into a sorted queue n times. "
+                "Generate random string(s) if str equals RAND. "
+                "(default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(index, "Enable or disable the skip-list index of queue",
+                "[on|off]");
+    ADD_COMMAND(find,
+                "Find str in a sorted queue and count the elements before it",
+                "str");
+    ADD_COMMAND(dv, "Delete the first node holding str from a sorted queue",
+                "str");
+    ADD_COMMAND(get, "Show the element at position pos of queue", "pos");
+    ADD_COMMAND(ia, "Insert string str at position pos of queue", "pos str");
+    ADD_COMMAND(da, "Delete the element at position pos of queue", "pos");
     ADD_COMMAND(
         rh,
         "Remove from head of queue. Optionally compare to expected value str",
@@ -1074,6 +1998,8 @@ static void console_init()
         rt,
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
+    ADD_COMMAND(rhb, "Remove n elements from head of queue in batches", "n");
+    ADD_COMMAND(rtb, "Remove n elements from tail of queue in batches", "n");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending order", "");
     ADD_COMMAND(list_sort, "Sort queue in ascending order with list sort", "");
@@ -1081,7 +2007,10 @@ static void console_init()
     ADD_COMMAND(shuffle, "Shuffle queue elements", "");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
-    ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(dedup,
+                "Delete all nodes that have duplicate string, 'hash' also "
+                "finds duplicates in unsorted queues",
+                "[hash]");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(descend,
@@ -1090,10 +2019,35 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(posbench,
+                "Time positional access on queues of sizes up to max, "
+                "ops operations each",
+                "[max] [ops]");
+    ADD_COMMAND(mpmc,
+                "Pass elements from 'threads' producers to as many consumers "
+                "through the lock-free queue, then a locked list",
+                "[n]");
+    ADD_COMMAND(bqueue,
+                "Pass elements from 'threads' producers to as many consumers "
+                "through the blocking queue, 0 capacity for unbounded",
+                "[n] [capacity]");
+    ADD_COMMAND(spsc,
+                "Pass elements from one pinned thread to another through the "
+                "single-producer queue",
+                "[n] [batch]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("sort", &sort_engine,
+              "Sort engine used by sort (0: merge, 1: list, 2: radix, "
+              "3: parallel merge, 4: array)",
+              NULL);
+    add_param("merge", &merge_parallel,
+              "Merge engine used by merge (0: heap, 1: parallel reduction)",
+              NULL);
+    add_param("threads", &thread_count,
+              "Number of threads used by parallel operations", NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
 }
@@ -1159,11 +2113,16 @@ static bool q_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE][-b BACKEND]\n",
+           cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f IFILE   Read commands from IFILE\n");
     printf("\t-v VLEVEL  Set verbosity level\n");
     printf("\t-l LFILE   Echo results to LFILE\n");
+    printf("\t-b BACKEND Store queues in BACKEND:");
+    for (int i = 0; i < Q_BACKEND_COUNT; i++)
+        printf(" %s", backend_names[i]);
+    printf(" (default: %s)\n", backend_names[Q_BACKEND_LIST]);
     exit(0);
 }
 
@@ -1234,7 +2193,7 @@ int main(int argc, char *argv[])
     int level = 4;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hv:f:l:b:")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -1259,6 +2218,16 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 'b': {
+            int b = 0;
+            while (b < Q_BACKEND_COUNT && strcmp(optarg, backend_names[b]))
+                b++;
+            if (!q_set_backend(b)) {
+                fprintf(stderr, "Unknown backend '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
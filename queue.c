@@ -1,11 +1,20 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // clang-format off
 #include "queue.h"
+#include "backend.h"
 #include "custom.h"
 #include "random.h"
+#include "skiplist.h"
 // clang-format on
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
@@ -14,11 +23,239 @@
  *   cppcheck-suppress nullPointer
  */
 
-static void delete_node(element_t *e)
+#define to_queue(h) list_entry(h, queue_t, head)
+
+/* Comparisons which the key prefix could not decide. Sort workers count on
+ * their own and hand the result over to worker_fallbacks when they finish.
+ */
+static __thread size_t strcmp_fallbacks = 0;
+static size_t worker_fallbacks = 0;
+
+/* Pack the first 8 bytes of @s into a big-endian key, zero padded */
+static uint64_t key_of(const char *s)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        key <<= 8;
+        if (*s)
+            key |= (unsigned char) *s++;
+    }
+    return key;
+}
+
+/* Order two elements like strcmp() on their values */
+static inline int cmp_element(const element_t *a, const element_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    /* Equal keys with a terminator inside them mean equal strings */
+    if (!(a->key & 0xff))
+        return 0;
+    strcmp_fallbacks++;
+    return strcmp(a->value, b->value);
+}
+
+size_t q_strcmp_fallbacks(void)
+{
+    return strcmp_fallbacks + worker_fallbacks;
+}
+
+void q_reset_strcmp_fallbacks(void)
+{
+    strcmp_fallbacks = 0;
+    worker_fallbacks = 0;
+}
+
+/* Drop the finger of q_insert_sorted() before elements of @head go away */
+static inline void forget_finger(struct list_head *head)
+{
+    to_queue(head)->finger = NULL;
+}
+
+/* Forget everything kept about the layout of @head, before an operation
+ * which changes it in a way the index does not follow. The index is only
+ * marked stale, so this is safe where allocation is not.
+ */
+static inline void forget_layout(struct list_head *head)
+{
+    forget_finger(head);
+    skip_invalidate(to_queue(head)->index);
+    to_queue(head)->mid = NULL;
+}
+
+/* Put the chain of a list queue back in queue order, if q_reverse() left
+ * it linked backwards. One pass swapping the two links of every node, the
+ * sentinel included.
+ */
+static void settle(struct list_head *head)
+{
+    queue_t *q = to_queue(head);
+    if (!q->reversed)
+        return;
+
+    struct list_head *node = head;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != head);
+    q->reversed = false;
+}
+
+/* Neighbours of @node in queue order, whichever way the chain is linked */
+static inline struct list_head *next_of(const queue_t *q,
+                                        struct list_head *node)
+{
+    return q->reversed ? node->prev : node->next;
+}
+
+static inline struct list_head *prev_of(const queue_t *q,
+                                        struct list_head *node)
+{
+    return q->reversed ? node->next : node->prev;
+}
+
+/* The middle of a queue of n elements is the one at position n / 2. An
+ * insertion or removal moves it by at most one, depending on which side
+ * of it the change happens and on the parity of n, so the helpers below
+ * keep it in O(1) as long as the position of the change is known.
+ */
+
+/* Follow the insertion of @node at @rank, @q->size already counting it */
+static inline void mid_after_insert(queue_t *q,
+                                    struct list_head *node,
+                                    size_t rank)
+{
+    size_t n = q->size - 1, m = n / 2;
+
+    if (n == 0) {
+        q->mid = node;
+        return;
+    }
+    if (!q->mid)
+        return;
+
+    bool odd = n & 1;
+    if (rank <= m && !odd)
+        q->mid = prev_of(q, q->mid);
+    else if (rank > m && odd)
+        q->mid = next_of(q, q->mid);
+}
+
+/* Follow the removal of the element at @rank, before it is unlinked */
+static inline void mid_before_remove(queue_t *q, size_t rank)
+{
+    size_t n = q->size, m = n / 2;
+
+    if (!q->mid)
+        return;
+    if (n == 1) {
+        q->mid = NULL;
+        return;
+    }
+
+    bool odd = n & 1;
+    if (rank == m)
+        q->mid = odd ? next_of(q, q->mid) : prev_of(q, q->mid);
+    else if (rank < m && odd)
+        q->mid = next_of(q, q->mid);
+    else if (rank > m && !odd)
+        q->mid = prev_of(q, q->mid);
+}
+
+/* The index of @head when it is enabled and up to date, else NULL */
+static skip_index_t *index_of(struct list_head *head)
+{
+    queue_t *q = to_queue(head);
+    return skip_valid(q->index) ? q->index : NULL;
+}
+
+/* Node of the element at @rank of a list queue, the sentinel for @rank ==
+ * size. Through the index when there is one, else by walking from whichever
+ * of the ends and the middle is nearest, so at most a quarter of the queue.
+ */
+static struct list_head *seek(struct list_head *head, size_t rank)
+{
+    queue_t *q = to_queue(head);
+    size_t size = q->size;
+
+    if (rank >= size)
+        return head;
+    if (q->index) {
+        settle(head);
+        if (skip_ready(q->index, head, size))
+            return skip_seek(q->index, head, rank);
+    }
+
+    /* Steps to take, forward if positive, from the sentinel */
+    struct list_head *node = head;
+    long steps = rank < size - rank ? (long) rank + 1 : (long) rank - size;
+    long from_mid = (long) rank - (long) (size / 2);
+    if (q->mid && labs(from_mid) < labs(steps)) {
+        node = q->mid;
+        steps = from_mid;
+    }
+
+    for (; steps > 0; steps--)
+        node = next_of(q, node);
+    for (; steps < 0; steps++)
+        node = prev_of(q, node);
+    return node;
+}
+
+static void delete_node(queue_t *q, element_t *e)
 {
     list_del(&e->list);
-    free(e->value);
-    free(e);
+    q->size--;
+    q_release_element(e);
+}
+
+/* Delete @e, the element at @rank of a list queue, keeping the finger, the
+ * middle and the index in step
+ */
+static void delete_ranked(queue_t *q, element_t *e, size_t rank)
+{
+    if (&e->list == q->finger)
+        forget_finger(&q->head);
+    mid_before_remove(q, rank);
+    skip_index_t *ix = index_of(&q->head);
+    if (ix)
+        skip_remove(ix, rank);
+    delete_node(q, e);
+}
+
+/* Allocate an element holding a copy of @s */
+static element_t *new_element(const char *s)
+{
+    element_t *e = pool_alloc(sizeof(element_t));
+    if (e == NULL)
+        return NULL;
+
+    size_t len = strlen(s) + 1;
+    if (len <= Q_INLINE_LEN) {
+        e->value = e->inline_value;
+    } else {
+        e->value = pool_alloc(len);
+        if (e->value == NULL) {
+            pool_free(e);
+            return NULL;
+        }
+        e->inline_value[0] = '\0';
+    }
+    memcpy(e->value, s, len);
+    e->key = key_of(e->value);
+    return e;
+}
+
+/* Copy @value to @sp, truncated to @bufsize - 1 characters */
+static void copy_value(char *sp, size_t bufsize, const char *value)
+{
+    if (!value || !sp || bufsize == 0)
+        return;
+
+    if (!memccpy(sp, value, '\0', bufsize - 1))
+        sp[bufsize - 1] = '\0';
 }
 
 
@@ -34,18 +271,212 @@ static struct list_head *find_mid(struct list_head *head, size_t len)
     return entry;
 }
 
+/* Backends other than the list, see backend.h */
+static const queue_ops_t *const backends[Q_BACKEND_COUNT] = {
+    [Q_BACKEND_CHUNK] = &chunk_ops,
+    [Q_BACKEND_RING] = &ring_ops,
+};
+
+/* Backend of the queues q_new() creates */
+static int default_backend = Q_BACKEND_LIST;
+
+/* Operations of the backend keeping @head, NULL for the list. A NULL
+ * queue gets NULL too, so that it takes the list path, which checks for it.
+ */
+static inline const queue_ops_t *ops_of(struct list_head *head)
+{
+    return head ? backends[to_queue(head)->backend] : NULL;
+}
+
+bool q_set_backend(int backend)
+{
+    if (backend < 0 || backend >= Q_BACKEND_COUNT)
+        return false;
+
+    default_backend = backend;
+    return true;
+}
+
+bool q_reserve(struct list_head *head, int n)
+{
+    if (!head)
+        return false;
+
+    const queue_ops_t *ops = ops_of(head);
+    if (!ops || !ops->reserve || n <= q_size(head))
+        return true;
+    return ops->reserve(to_queue(head), n);
+}
+
+/* Copy the element pointers of @head, in order, to @v */
+static void load_array(struct list_head *head, element_t **v)
+{
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        ops->gather(to_queue(head), v);
+        return;
+    }
+
+    /* Fetch a few nodes ahead to overlap the cache misses */
+    struct list_head *node;
+    list_for_each (node, head) {
+        __builtin_prefetch(node->next->next);
+        *v++ = list_entry(node, element_t, list);
+    }
+}
+
+/* Make the @n elements in @v the contents of @head, in that order. @n may
+ * be smaller than the current size when elements were dropped.
+ */
+static void store_array(struct list_head *head, element_t **v, size_t n)
+{
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        ops->scatter(to_queue(head), v, n);
+        return;
+    }
+
+    struct list_head *prev = head;
+    for (size_t i = 0; i < n; i++) {
+        struct list_head *node = &v[i]->list;
+        prev->next = node;
+        node->prev = prev;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+    to_queue(head)->size = n;
+}
+
+/* Chain the elements of @head, in order and NULL terminated, through their
+ * list nodes. Only for backends other than the list, which leave those
+ * nodes unused, when there is no scratch memory for an array.
+ */
+static struct list_head *link_elements(struct list_head *head)
+{
+    struct list_head *first = NULL, **tail = &first;
+    q_iter_t it;
+    for (element_t *e = q_iter_first(head, &it); e; e = q_iter_next(&it)) {
+        *tail = &e->list;
+        tail = &e->list.next;
+    }
+    *tail = NULL;
+    return first;
+}
+
+/* Store a chain from link_elements(), as long as the queue, back into it */
+static void store_linked(struct list_head *head, struct list_head *list)
+{
+    const queue_ops_t *ops = ops_of(head);
+    q_iter_t it;
+    for (element_t *e = ops->iter_first(to_queue(head), &it, false); e;
+         e = ops->iter_step(&it, false)) {
+        ops->iter_store(&it, list_entry(list, element_t, list));
+        list = list->next;
+    }
+}
+
+static void release_array(element_t **v, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        q_release_element(v[i]);
+}
+
+/* Rearrange the @n element pointers in @v, move the ones which stay to the
+ * front, release the others and return how many stay.
+ */
+typedef size_t (*array_op_t)(element_t **v, size_t n, void *arg);
+
+/* Run @op on a scratch copy of the element pointers of @head and store the
+ * result back. This is how backends other than the list get the operations
+ * which rearrange or drop elements throughout the queue.
+ *
+ * Return: false, leaving the queue alone, if no scratch buffer is available
+ */
+static bool apply_array(struct list_head *head, array_op_t op, void *arg)
+{
+    size_t n = q_size(head);
+    element_t **v = test_scratch_alloc(n * sizeof(element_t *));
+    if (!v)
+        return false;
+
+    load_array(head, v);
+    store_array(head, v, op(v, n, arg));
+    test_scratch_free(v);
+    return true;
+}
+
+element_t *q_iter_first(struct list_head *head, q_iter_t *it)
+{
+    if (!head)
+        return NULL;
+
+    const queue_ops_t *ops = ops_of(head);
+    if (ops)
+        return ops->iter_first(to_queue(head), it, false);
+
+    it->head = head;
+    it->node = next_of(to_queue(head), head);
+    return it->node == head ? NULL : list_entry(it->node, element_t, list);
+}
+
+element_t *q_iter_last(struct list_head *head, q_iter_t *it)
+{
+    if (!head)
+        return NULL;
+
+    const queue_ops_t *ops = ops_of(head);
+    if (ops)
+        return ops->iter_first(to_queue(head), it, true);
+
+    it->head = head;
+    it->node = prev_of(to_queue(head), head);
+    return it->node == head ? NULL : list_entry(it->node, element_t, list);
+}
+
+element_t *q_iter_next(q_iter_t *it)
+{
+    const queue_ops_t *ops = ops_of(it->head);
+    if (ops)
+        return ops->iter_step(it, false);
+
+    it->node = next_of(to_queue(it->head), it->node);
+    return it->node == it->head ? NULL
+                                : list_entry(it->node, element_t, list);
+}
+
+element_t *q_iter_prev(q_iter_t *it)
+{
+    const queue_ops_t *ops = ops_of(it->head);
+    if (ops)
+        return ops->iter_step(it, true);
+
+    it->node = prev_of(to_queue(it->head), it->node);
+    return it->node == it->head ? NULL
+                                : list_entry(it->node, element_t, list);
+}
 
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    element_t *q = malloc(sizeof(element_t));
+    if (backends[default_backend]) {
+        queue_t *q = backends[default_backend]->create();
+        return q ? &q->head : NULL;
+    }
+
+    queue_t *q = malloc(sizeof(queue_t));
     if (q == NULL)
         return NULL;
 
-    q->value = NULL;
-    INIT_LIST_HEAD(&q->list);
+    q->size = 0;
+    q->backend = Q_BACKEND_LIST;
+    q->finger = NULL;
+    q->index = NULL;
+    q->reversed = false;
+    q->mid = NULL;
+    INIT_LIST_HEAD(&q->head);
 
-    return &q->list;
+    return &q->head;
 }
 
 
@@ -55,13 +486,23 @@ void q_free(struct list_head *l)
     if (l == NULL)
         return;
 
+    queue_t *q = to_queue(l);
+    const queue_ops_t *ops = ops_of(l);
+    if (ops) {
+        element_t *e;
+        while ((e = ops->pop_head(q)))
+            q_release_element(e);
+        ops->destroy(q);
+        return;
+    }
+
     element_t *cur, *next;
     list_for_each_entry_safe (cur, next, l, list) {
-        delete_node(cur);
+        delete_node(q, cur);
     }
+    skip_free(q->index);
     /* free the head */
-    cur = list_entry(l, element_t, list);
-    free(cur);
+    free(q);
 }
 
 /* Insert an element at head of queue */
@@ -70,17 +511,28 @@ bool q_insert_head(struct list_head *head, char *s)
     if (head == NULL || s == NULL)
         return false;
 
-    element_t *node = malloc(sizeof(element_t));
+    element_t *node = new_element(s);
     if (node == NULL)
         return false;
 
-    node->value = strdup(s);
-    if (node->value == NULL) {
-        free(node);
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        if (ops->push_head(to_queue(head), node))
+            return true;
+        q_release_element(node);
         return false;
     }
 
-    list_add(&node->list, head);
+    queue_t *q = to_queue(head);
+    if (q->reversed)
+        list_add_tail(&node->list, head);
+    else
+        list_add(&node->list, head);
+    q->size++;
+    mid_after_insert(q, &node->list, 0);
+    skip_index_t *ix = index_of(head);
+    if (ix)
+        skip_insert(ix, &node->list, 0);
     return true;
 }
 
@@ -90,172 +542,927 @@ bool q_insert_tail(struct list_head *head, char *s)
     if (head == NULL || s == NULL)
         return false;
 
-    element_t *node = malloc(sizeof(element_t));
+    element_t *node = new_element(s);
     if (node == NULL)
         return false;
 
-    node->value = strdup(s);
-    if (node->value == NULL) {
-        free(node);
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        if (ops->push_tail(to_queue(head), node))
+            return true;
+        q_release_element(node);
         return false;
     }
 
-    list_add_tail(&node->list, head);
+    queue_t *q = to_queue(head);
+    if (q->reversed)
+        list_add(&node->list, head);
+    else
+        list_add_tail(&node->list, head);
+    q->size++;
+    mid_after_insert(q, &node->list, q->size - 1);
+    skip_index_t *ix = index_of(head);
+    if (ix)
+        skip_insert(ix, &node->list, q->size - 1);
     return true;
 }
 
-/* Remove an element from head of queue */
-element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+/* Move the last of the @n elements in @v, just appended, to the rank @arg
+ * points to
+ */
+static size_t move_last_array(element_t **v, size_t n, void *arg)
 {
-    if (head == NULL || list_empty(head))
-        return NULL;
-
-    struct list_head *first = head->next;
-    list_del(first);
-
-    element_t *entry = list_entry(first, element_t, list);
-    size_t slen, dlen;
+    size_t rank = *(size_t *) arg;
+    element_t *e = v[n - 1];
 
-    if (!entry->value || !sp || bufsize == 0)
-        return entry;
-
-    slen = strlen(entry->value);
-    dlen = slen < (bufsize - 1) ? slen : (bufsize - 1);
-    strncpy(sp, entry->value, dlen);
-    sp[dlen] = '\0';
-
-    return entry;
+    memmove(v + rank + 1, v + rank, (n - 1 - rank) * sizeof(element_t *));
+    v[rank] = e;
+    return n;
 }
 
-/* Remove an element from tail of queue */
-element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+/* Move the last of the @n elements in @v, just appended, to its sorted
+ * place among the others
+ */
+static size_t place_last_array(element_t **v, size_t n, void *arg)
 {
-    if (head == NULL || head->next == NULL)
-        return NULL;
-
-    struct list_head *last = head->prev;
-    list_del(last);
-
-    element_t *entry = list_entry(last, element_t, list);
-    size_t slen, dlen;
-
-    if (!entry->value || !sp || bufsize == 0)
-        return entry;
-
-    slen = strlen(entry->value);
-    dlen = slen < (bufsize - 1) ? slen : (bufsize - 1);
-    strncpy(sp, entry->value, dlen);
-    sp[dlen] = '\0';
-
-    return entry;
+    element_t *e = v[n - 1];
+    size_t lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cmp_element(v[mid], e) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return move_last_array(v, n, &lo);
 }
 
-/* Return number of elements in queue */
-int q_size(struct list_head *head)
+/* Insert an element in order into a sorted queue */
+bool q_insert_sorted(struct list_head *head, char *s)
 {
-    int len = 0;
-    const struct list_head *node;
-    if (!head)
-        return 0;
-    list_for_each (node, head)
-        len++;
-    return len;
-}
+    if (head == NULL || s == NULL)
+        return false;
 
-/* Delete the middle node in queue */
-bool q_delete_mid(struct list_head *head)
-{
-    if (head == NULL || list_empty(head))
+    element_t *node = new_element(s);
+    if (node == NULL)
         return false;
 
-    // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
-    size_t size = q_size(head);
-    struct list_head *mid = find_mid(head->next, size);
-    element_t *entry = list_entry(mid, element_t, list);
+    queue_t *q = to_queue(head);
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        if (!ops->push_tail(q, node)) {
+            q_release_element(node);
+            return false;
+        }
+        if (!apply_array(head, place_last_array, NULL)) {
+            q_release_element(ops->pop_tail(q));
+            return false;
+        }
+        return true;
+    }
+
+    settle(head);
+
+    /* The index finds the spot, and its rank, in O(log n) from anywhere */
+    if (q->index && skip_ready(q->index, head, q->size)) {
+        size_t rank;
+        struct list_head *next =
+            skip_search(q->index, head, node, cmp_element, true, &rank);
+        list_add_tail(&node->list, next);
+        q->size++;
+        q->finger = &node->list;
+        mid_after_insert(q, &node->list, rank);
+        skip_insert(q->index, &node->list, rank);
+        return true;
+    }
+
+    /* @fwd only has elements not greater than @node up to it, and @bwd only
+     * greater ones from it on, the sentinel standing for either end. The
+     * finger lets one of them start right next to the spot.
+     */
+    struct list_head *fwd = head, *bwd = head, *pos;
+    if (q->finger) {
+        if (cmp_element(list_entry(q->finger, element_t, list), node) <= 0)
+            fwd = q->finger;
+        else
+            bwd = q->finger;
+    }
+
+    /* Step both in turn, whichever reaches the spot first wins */
+    while (1) {
+        if (fwd->next == head ||
+            cmp_element(list_entry(fwd->next, element_t, list), node) > 0) {
+            pos = fwd;
+            break;
+        }
+        fwd = fwd->next;
 
-    delete_node(entry);
+        if (bwd->prev == head ||
+            cmp_element(list_entry(bwd->prev, element_t, list), node) <= 0) {
+            pos = bwd->prev;
+            break;
+        }
+        bwd = bwd->prev;
+    }
 
+    /* Where that is relative to the middle is unknown without a rank */
+    list_add(&node->list, pos);
+    q->size++;
+    q->finger = &node->list;
+    q->mid = NULL;
     return true;
 }
 
-/* Delete all nodes that have duplicate string */
-bool q_delete_dup(struct list_head *head)
+bool q_set_index(struct list_head *head, bool enable)
 {
-    // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
-    if (head == NULL || list_empty(head))
+    if (head == NULL || ops_of(head))
         return false;
 
-    bool dup = false;
-    element_t *entry, *safe, *ori = NULL;
-    list_for_each_entry_safe (entry, safe, head, list) {
-        if (ori && ori->value && entry->value &&
-            strcmp(ori->value, entry->value) == 0) {
-            delete_node(entry);
-            dup = true;
-        } else {
-            if (dup)
-                delete_node(ori);
-            ori = entry;
-            dup = false;
-        }
+    queue_t *q = to_queue(head);
+    if (!enable) {
+        skip_free(q->index);
+        q->index = NULL;
+    } else if (!q->index) {
+        q->index = skip_new();
+        if (!q->index)
+            return false;
     }
-    if (dup)
-        delete_node(ori);
     return true;
 }
 
-/* Swap every two adjacent nodes */
-void q_swap(struct list_head *head)
+/* Stand-in element for comparing @s against the elements of a queue */
+static element_t key_element(const char *s)
 {
-    // https://leetcode.com/problems/swap-nodes-in-pairs/
-    if (head == NULL)
-        return;
+    return (element_t){.value = (char *) s, .key = key_of(s)};
+}
 
-    struct list_head *former, *latter;
-    list_for_each (former, head) {
-        latter = former->next;
-        if (latter != head) {
-            latter->prev = former->prev;
-            former->prev->next = latter;
+/* Count the elements of a sorted queue which are less than @key, the slow
+ * way. Leave @it on the first one which is not, if any, and return it in
+ * @e.
+ */
+static size_t scan_rank(struct list_head *head,
+                        const element_t *key,
+                        q_iter_t *it,
+                        element_t **e)
+{
+    size_t rank = 0;
+    element_t *cur = q_iter_first(head, it);
 
-            former->next = latter->next;
-            latter->next->prev = former;
+    for (; cur && cmp_element(cur, key) < 0; cur = q_iter_next(it))
+        rank++;
+    *e = cur;
+    return rank;
+}
 
-            latter->next = former;
-            former->prev = latter;
+/* Look @key up in a sorted queue, through the index when there is one.
+ * Return the first element not less than @key, NULL if none, and store its
+ * rank in @rank.
+ */
+static element_t *lookup(struct list_head *head,
+                         const element_t *key,
+                         size_t *rank)
+{
+    queue_t *q = to_queue(head);
+
+    if (!ops_of(head) && q->index) {
+        settle(head);
+        if (skip_ready(q->index, head, q->size)) {
+            struct list_head *node =
+                skip_search(q->index, head, key, cmp_element, false, rank);
+            return node == head ? NULL : list_entry(node, element_t, list);
         }
     }
+
+    q_iter_t it;
+    element_t *e;
+    *rank = scan_rank(head, key, &it, &e);
+    return e;
 }
 
-/* Reverse elements in queue */
-void q_reverse(struct list_head *head)
+element_t *q_find(struct list_head *head, const char *s)
+{
+    if (head == NULL || s == NULL)
+        return NULL;
+
+    element_t key = key_element(s);
+    size_t rank;
+    element_t *e = lookup(head, &key, &rank);
+    return e && cmp_element(e, &key) == 0 ? e : NULL;
+}
+
+int q_rank(struct list_head *head, const char *s)
+{
+    if (head == NULL || s == NULL)
+        return 0;
+
+    element_t key = key_element(s);
+    size_t rank;
+    lookup(head, &key, &rank);
+    return rank;
+}
+
+/* Drop the element at the rank @arg points to */
+static size_t delete_at_array(element_t **v, size_t n, void *arg)
+{
+    size_t rank = *(size_t *) arg;
+
+    q_release_element(v[rank]);
+    memmove(v + rank, v + rank + 1, (n - rank - 1) * sizeof(element_t *));
+    return n - 1;
+}
+
+bool q_delete_value(struct list_head *head, const char *s)
+{
+    if (head == NULL || s == NULL)
+        return false;
+
+    element_t key = key_element(s);
+    size_t rank;
+    element_t *e = lookup(head, &key, &rank);
+    if (!e || cmp_element(e, &key) != 0)
+        return false;
+    if (ops_of(head))
+        return apply_array(head, delete_at_array, &rank);
+
+    delete_ranked(to_queue(head), e, rank);
+    return true;
+}
+
+element_t *q_get(struct list_head *head, int i)
+{
+    if (head == NULL || i < 0 || i >= q_size(head))
+        return NULL;
+
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        q_iter_t it;
+        return ops->iter_at(to_queue(head), &it, i);
+    }
+    return list_entry(seek(head, i), element_t, list);
+}
+
+bool q_insert_at(struct list_head *head, int i, char *s)
+{
+    if (head == NULL || s == NULL || i < 0 || i > q_size(head))
+        return false;
+
+    element_t *node = new_element(s);
+    if (node == NULL)
+        return false;
+
+    queue_t *q = to_queue(head);
+    size_t rank = i;
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        if (!ops->push_tail(q, node)) {
+            q_release_element(node);
+            return false;
+        }
+        if (!apply_array(head, move_last_array, &rank)) {
+            q_release_element(ops->pop_tail(q));
+            return false;
+        }
+        return true;
+    }
+
+    /* In front of the element now at @rank, the sentinel past the tail */
+    struct list_head *next = seek(head, rank);
+    if (q->reversed)
+        list_add(&node->list, next);
+    else
+        list_add_tail(&node->list, next);
+    q->size++;
+    mid_after_insert(q, &node->list, rank);
+    skip_index_t *ix = index_of(head);
+    if (ix)
+        skip_insert(ix, &node->list, rank);
+    return true;
+}
+
+bool q_delete_at(struct list_head *head, int i)
+{
+    if (head == NULL || i < 0 || i >= q_size(head))
+        return false;
+
+    size_t rank = i;
+    if (ops_of(head))
+        return apply_array(head, delete_at_array, &rank);
+
+    delete_ranked(to_queue(head), list_entry(seek(head, rank), element_t, list),
+                  rank);
+    return true;
+}
+
+/* Release every element linked on @list */
+static void release_chain(struct list_head *list)
+{
+    element_t *cur, *next;
+    list_for_each_entry_safe (cur, next, list, list)
+        q_release_element(cur);
+}
+
+/* Build a chain of @n new elements on @chain, the i-th holding sv[i % nsv].
+ * When @at_head, each element goes in front of the previous one, mirroring
+ * a sequence of q_insert_head calls.
+ */
+static bool build_chain(struct list_head *chain,
+                        char **sv,
+                        int nsv,
+                        int n,
+                        bool at_head)
+{
+    for (int i = 0; i < n; i++) {
+        element_t *node = new_element(sv[i % nsv]);
+        if (node == NULL) {
+            release_chain(chain);
+            return false;
+        }
+        if (at_head)
+            list_add(&node->list, chain);
+        else
+            list_add_tail(&node->list, chain);
+    }
+    return true;
+}
+
+/* Bulk insertion for backends other than the list: push the elements one by
+ * one and take them all out again if one of them fails.
+ */
+static bool push_bulk(struct list_head *head,
+                      char **sv,
+                      int nsv,
+                      int n,
+                      bool at_head)
+{
+    const queue_ops_t *ops = ops_of(head);
+    queue_t *q = to_queue(head);
+
+    for (int i = 0; i < n; i++) {
+        element_t *e = new_element(sv[i % nsv]);
+        if (e && (at_head ? ops->push_head(q, e) : ops->push_tail(q, e)))
+            continue;
+
+        if (e)
+            q_release_element(e);
+        while (i-- > 0)
+            q_release_element(at_head ? ops->pop_head(q) : ops->pop_tail(q));
+        return false;
+    }
+    return true;
+}
+
+/* Append the @n elements of @v to @head, which takes them over. On failure
+ * none of them is left in the queue.
+ */
+static bool append_elements(struct list_head *head, element_t **v, size_t n)
+{
+    const queue_ops_t *ops = ops_of(head);
+    queue_t *q = to_queue(head);
+
+    if (ops) {
+        for (size_t i = 0; i < n; i++) {
+            if (ops->push_tail(q, v[i]))
+                continue;
+            while (i-- > 0)
+                ops->pop_tail(q);
+            return false;
+        }
+        return true;
+    }
+
+    LIST_HEAD(chain);
+    for (size_t i = 0; i < n; i++) {
+        if (q->reversed)
+            list_add(&v[i]->list, &chain);
+        else
+            list_add_tail(&v[i]->list, &chain);
+    }
+
+    forget_layout(head);
+    if (q->reversed)
+        list_splice(&chain, head);
+    else
+        list_splice_tail(&chain, head);
+    q->size += n;
+    return true;
+}
+
+/* Insert n elements at head of queue */
+bool q_insert_head_bulk(struct list_head *head, char **sv, int nsv, int n)
+{
+    if (head == NULL || sv == NULL || nsv <= 0 || n < 0)
+        return false;
+    if (ops_of(head))
+        return push_bulk(head, sv, nsv, n, true);
+
+    /* The head of a reversed queue is at the end of its chain */
+    bool front = !to_queue(head)->reversed;
+    LIST_HEAD(chain);
+    if (!build_chain(&chain, sv, nsv, n, front))
+        return false;
+
+    forget_layout(head);
+    if (front)
+        list_splice(&chain, head);
+    else
+        list_splice_tail(&chain, head);
+    to_queue(head)->size += n;
+    return true;
+}
+
+/* Insert n elements at tail of queue */
+bool q_insert_tail_bulk(struct list_head *head, char **sv, int nsv, int n)
+{
+    if (head == NULL || sv == NULL || nsv <= 0 || n < 0)
+        return false;
+    if (ops_of(head))
+        return push_bulk(head, sv, nsv, n, false);
+
+    bool front = to_queue(head)->reversed;
+    LIST_HEAD(chain);
+    if (!build_chain(&chain, sv, nsv, n, front))
+        return false;
+
+    forget_layout(head);
+    if (front)
+        list_splice(&chain, head);
+    else
+        list_splice_tail(&chain, head);
+    to_queue(head)->size += n;
+    return true;
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (head == NULL)
+        return NULL;
+
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        element_t *e = ops->pop_head(to_queue(head));
+        if (e)
+            copy_value(sp, bufsize, e->value);
+        return e;
+    }
+
+    if (list_empty(head))
+        return NULL;
+
+    queue_t *q = to_queue(head);
+    struct list_head *first = next_of(q, head);
+    if (first == q->finger)
+        forget_finger(head);
+    mid_before_remove(q, 0);
+    skip_index_t *ix = index_of(head);
+    if (ix)
+        skip_remove(ix, 0);
+    list_del(first);
+    q->size--;
+
+    element_t *entry = list_entry(first, element_t, list);
+    copy_value(sp, bufsize, entry->value);
+    return entry;
+}
+
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (head == NULL)
+        return NULL;
+
+    const queue_ops_t *ops = ops_of(head);
+    if (ops) {
+        element_t *e = ops->pop_tail(to_queue(head));
+        if (e)
+            copy_value(sp, bufsize, e->value);
+        return e;
+    }
+
+    if (list_empty(head))
+        return NULL;
+
+    queue_t *q = to_queue(head);
+    struct list_head *last = prev_of(q, head);
+    if (last == q->finger)
+        forget_finger(head);
+    mid_before_remove(q, q->size - 1);
+    skip_index_t *ix = index_of(head);
+    if (ix)
+        skip_remove(ix, q->size - 1);
+    list_del(last);
+    q->size--;
+
+    element_t *entry = list_entry(last, element_t, list);
+    copy_value(sp, bufsize, entry->value);
+    return entry;
+}
+
+/* Pack the values of up to @n elements into @buf, starting at the head or,
+ * when @backward, at the tail. Stop before a value which no longer fits,
+ * unless it is the first one, which is truncated instead.
+ * Return the number of elements visited and leave @last on the last one.
+ */
+static int pack_values(struct list_head *head,
+                       bool backward,
+                       int n,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets,
+                       q_iter_t *last)
+{
+    q_iter_t it;
+    element_t *e = backward ? q_iter_last(head, &it) : q_iter_first(head, &it);
+    size_t pos = 0;
+    int k;
+
+    for (k = 0; k < n && e; k++) {
+        if (buf && bufsize > 0) {
+            const char *value = e->value;
+            size_t len = strlen(value) + 1;
+            if (pos + len > bufsize) {
+                if (k > 0)
+                    break;
+                len = bufsize;
+            }
+            memcpy(buf + pos, value, len - 1);
+            buf[pos + len - 1] = '\0';
+            if (offsets)
+                offsets[k] = pos;
+            pos += len;
+        }
+        *last = it;
+        e = backward ? q_iter_prev(&it) : q_iter_next(&it);
+    }
+    return k;
+}
+
+/* Take @k packed elements out of a queue kept by another backend */
+static void pop_bulk(struct list_head *head, int k, bool from_tail)
+{
+    const queue_ops_t *ops = ops_of(head);
+    queue_t *q = to_queue(head);
+
+    while (k-- > 0)
+        q_release_element(from_tail ? ops->pop_tail(q) : ops->pop_head(q));
+}
+
+/* Release the elements linked from the start of the chain of @head up to
+ * @last included
+ */
+static void drop_front(struct list_head *head, struct list_head *last)
+{
+    LIST_HEAD(drained);
+    list_cut_position(&drained, head, last);
+    release_chain(&drained);
+}
+
+/* Release the elements linked from @first to the end of the chain of @head */
+static void drop_back(struct list_head *head, struct list_head *first)
+{
+    /* Park the elements which stay, leaving only the drained ones behind */
+    LIST_HEAD(keep);
+    list_cut_position(&keep, head, first->prev);
+    release_chain(head);
+    INIT_LIST_HEAD(head);
+    list_splice(&keep, head);
+}
+
+/* Remove up to n elements from head of queue */
+int q_remove_head_bulk(struct list_head *head,
+                       int n,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets)
+{
+    if (head == NULL || q_size(head) == 0 || n <= 0)
+        return 0;
+
+    q_iter_t last;
+    int k = pack_values(head, false, n, buf, bufsize, offsets, &last);
+    if (ops_of(head)) {
+        pop_bulk(head, k, false);
+        return k;
+    }
+
+    forget_layout(head);
+    if (to_queue(head)->reversed)
+        drop_back(head, last.node);
+    else
+        drop_front(head, last.node);
+    to_queue(head)->size -= k;
+    return k;
+}
+
+/* Remove up to n elements from tail of queue */
+int q_remove_tail_bulk(struct list_head *head,
+                       int n,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets)
+{
+    if (head == NULL || q_size(head) == 0 || n <= 0)
+        return 0;
+
+    q_iter_t first;
+    int k = pack_values(head, true, n, buf, bufsize, offsets, &first);
+    if (ops_of(head)) {
+        pop_bulk(head, k, true);
+        return k;
+    }
+
+    forget_layout(head);
+    if (to_queue(head)->reversed)
+        drop_front(head, first.node);
+    else
+        drop_back(head, first.node);
+    to_queue(head)->size -= k;
+    return k;
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+    return to_queue(head)->size;
+}
+
+static size_t delete_mid_array(element_t **v, size_t n, void *arg)
+{
+    size_t mid = n / 2;
+
+    q_release_element(v[mid]);
+    memmove(v + mid, v + mid + 1, (n - mid - 1) * sizeof(element_t *));
+    return n - 1;
+}
+
+/* Delete the middle node in queue */
+bool q_delete_mid(struct list_head *head)
+{
+    if (head == NULL || q_size(head) == 0)
+        return false;
+    if (ops_of(head))
+        return apply_array(head, delete_mid_array, NULL);
+
+    // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
+    queue_t *q = to_queue(head);
+    size_t size = q->size;
+
+    /* Only searched for after an operation which lost track of it */
+    if (!q->mid)
+        q->mid = seek(head, size / 2);
+    delete_ranked(q, list_entry(q->mid, element_t, list), size / 2);
+
+    return true;
+}
+
+/* Every element equal to a neighbour goes. Kept ones are swapped to the
+ * front as they are found, so the neighbours still to be compared are
+ * untouched.
+ */
+static size_t delete_dup_array(element_t **v, size_t n, void *arg)
+{
+    element_t *prev = NULL;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        element_t *e = v[i];
+        bool dup = (prev && cmp_element(prev, e) == 0) ||
+                   (i + 1 < n && cmp_element(e, v[i + 1]) == 0);
+        prev = e;
+        if (!dup) {
+            v[i] = v[kept];
+            v[kept++] = e;
+        }
+    }
+    release_array(v + kept, n - kept);
+    return kept;
+}
+
+/* Delete all nodes that have duplicate string */
+bool q_delete_dup(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
+    if (head == NULL || q_size(head) == 0)
+        return false;
+    if (ops_of(head))
+        return apply_array(head, delete_dup_array, NULL);
+
+    settle(head);
+    forget_layout(head);
+    queue_t *q = to_queue(head);
+    bool dup = false;
+    element_t *entry, *safe, *ori = NULL;
+    list_for_each_entry_safe (entry, safe, head, list) {
+        if (ori && cmp_element(ori, entry) == 0) {
+            delete_node(q, entry);
+            dup = true;
+        } else {
+            if (dup)
+                delete_node(q, ori);
+            ori = entry;
+            dup = false;
+        }
+    }
+    if (dup)
+        delete_node(q, ori);
+    return true;
+}
+
+/**
+ * dedup_slot_t - Slot of the open-addressing table used by q_delete_dup_hash
+ * @e: first element seen with this value, NULL for an empty slot
+ * @hash: hash of the value of @e
+ * @dup: the value was seen more than once
+ */
+typedef struct {
+    element_t *e;
+    uint64_t hash;
+    bool dup;
+} dedup_slot_t;
+
+/* 64-bit FNV-1a */
+static uint64_t hash_string(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Find the slot holding the value of @e, or the empty slot it belongs in */
+static dedup_slot_t *dedup_find(dedup_slot_t *table,
+                                size_t mask,
+                                const element_t *e,
+                                uint64_t hash)
+{
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        dedup_slot_t *slot = &table[i];
+        if (!slot->e || (slot->hash == hash && slot->e->key == e->key &&
+                         !strcmp(slot->e->value, e->value)))
+            return slot;
+    }
+}
+
+/* Allocate a table for @n values, at most half full so probe sequences stay
+ * short. Store the index mask in @mask.
+ */
+static dedup_slot_t *dedup_table(size_t n, size_t *mask)
+{
+    size_t cap = 16;
+    while (cap < 2 * n)
+        cap <<= 1;
+
+    dedup_slot_t *table = test_scratch_alloc(cap * sizeof(dedup_slot_t));
+    if (table)
+        memset(table, 0, cap * sizeof(dedup_slot_t));
+    *mask = cap - 1;
+    return table;
+}
+
+/* Table of dedup_slot_t with its index mask, see dedup_table() */
+typedef struct {
+    dedup_slot_t *slot;
+    size_t mask;
+} dedup_table_t;
+
+/* q_delete_dup_hash() on an array of elements, counting values in the
+ * empty table @arg. Repeated values are swapped to the back and released.
+ */
+static size_t dedup_hash_array(element_t **v, size_t n, void *arg)
+{
+    dedup_slot_t *table = ((dedup_table_t *) arg)->slot;
+    size_t mask = ((dedup_table_t *) arg)->mask, kept = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t hash = hash_string(v[i]->value);
+        dedup_slot_t *slot = dedup_find(table, mask, v[i], hash);
+        if (slot->e) {
+            slot->dup = true;
+        } else {
+            slot->e = v[i];
+            slot->hash = hash;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        element_t *e = v[i];
+        if (!dedup_find(table, mask, e, hash_string(e->value))->dup) {
+            v[i] = v[kept];
+            v[kept++] = e;
+        }
+    }
+
+    release_array(v + kept, n - kept);
+    return kept;
+}
+
+bool q_delete_dup_hash(struct list_head *head)
+{
+    if (head == NULL || q_size(head) == 0)
+        return false;
+
+    size_t mask;
+    dedup_slot_t *table = dedup_table(q_size(head), &mask);
+    if (!table)
+        return false;
+    if (ops_of(head)) {
+        dedup_table_t t = {.slot = table, .mask = mask};
+        bool ok = apply_array(head, dedup_hash_array, &t);
+        test_scratch_free(table);
+        return ok;
+    }
+
+    settle(head);
+    forget_layout(head);
+
+    /* First pass: count every value, flagging the ones seen twice */
+    element_t *entry, *safe;
+    list_for_each_entry (entry, head, list) {
+        uint64_t hash = hash_string(entry->value);
+        dedup_slot_t *slot = dedup_find(table, mask, entry, hash);
+        if (slot->e) {
+            slot->dup = true;
+        } else {
+            slot->e = entry;
+            slot->hash = hash;
+        }
+    }
+
+    /* Second pass: unlink every copy of a flagged value. They are released
+     * only afterwards, since the table still refers to the first copies.
+     */
+    queue_t *q = to_queue(head);
+    LIST_HEAD(doomed);
+    list_for_each_entry_safe (entry, safe, head, list) {
+        uint64_t hash = hash_string(entry->value);
+        if (dedup_find(table, mask, entry, hash)->dup) {
+            list_move_tail(&entry->list, &doomed);
+            q->size--;
+        }
+    }
+
+    test_scratch_free(table);
+    list_for_each_entry_safe (entry, safe, &doomed, list)
+        q_release_element(entry);
+    return true;
+}
+
+/* Swap every two adjacent nodes */
+void q_swap(struct list_head *head)
 {
+    // https://leetcode.com/problems/swap-nodes-in-pairs/
     if (head == NULL)
         return;
+    if (ops_of(head)) {
+        ops_of(head)->swap(to_queue(head));
+        return;
+    }
+    settle(head);
+    forget_layout(head);
+
+    struct list_head *former, *latter;
+    list_for_each (former, head) {
+        latter = former->next;
+        if (latter != head) {
+            latter->prev = former->prev;
+            former->prev->next = latter;
 
-    struct list_head *entry, *former = head, *safe;
-    list_for_each (entry, head) {
-        entry->prev = entry->next;
+            former->next = latter->next;
+            latter->next->prev = former;
+
+            latter->next = former;
+            former->prev = latter;
+        }
     }
+}
 
-    entry = head->next;
-    safe = entry->next;
-    while (1) {
-        /* Suppress unreadVariable */
-        (void) safe;
-        if (entry == head)
-            break;
-        safe = entry->next;
-        entry->next = former;
-        former = entry;
-        entry = safe;
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (head == NULL)
+        return;
+    if (ops_of(head)) {
+        ops_of(head)->reverse(to_queue(head));
+        return;
     }
 
-    /* Swap head's next and prev */
-    struct list_head *tmp;
-    tmp = head->next;
-    head->next = head->prev;
-    head->prev = tmp;
+    /* Nothing moves: the links are read the other way round from now on,
+     * until an operation which walks the chain calls settle()
+     */
+    queue_t *q = to_queue(head);
+    forget_finger(head);
+    skip_invalidate(q->index);
+    q->reversed = !q->reversed;
+
+    /* Position n / 2 is the mirror of itself only for odd n */
+    if (q->mid && !(q->size & 1))
+        q->mid = next_of(q, q->mid);
 }
 
 /* Reverse the nodes of the list k at a time */
@@ -263,8 +1470,14 @@ void q_reverseK(struct list_head *head, int k)
 {
     // https://leetcode.com/problems/reverse-nodes-in-k-group/
 
-    if (k <= 1 || head == NULL || list_empty(head))
+    if (k <= 1 || head == NULL || q_size(head) == 0)
+        return;
+    if (ops_of(head)) {
+        ops_of(head)->reverse_k(to_queue(head), k);
         return;
+    }
+    settle(head);
+    forget_layout(head);
 
     LIST_HEAD(last_head);
     LIST_HEAD(rcur_head);
@@ -342,7 +1555,7 @@ static struct list_head *merge_sort(struct list_head *head, size_t len)
         l_ele = list_entry(l_cur, element_t, list);
         r_ele = list_entry(r_cur, element_t, list);
 
-        if (strcmp(l_ele->value, r_ele->value) <= 0) {
+        if (cmp_element(l_ele, r_ele) <= 0) {
             tmp->next = l_cur;
             l_cur = l_cur->next;
             l--;
@@ -363,15 +1576,12 @@ static struct list_head *merge_sort(struct list_head *head, size_t len)
 }
 
 
-/* Sort elements of queue in ascending order */
-void q_sort(struct list_head *head)
+/* Hang the @len elements chained through next from @first back on @head,
+ * restoring the prev links on the way.
+ */
+static void relink(struct list_head *head, struct list_head *first, size_t len)
 {
-    if (head == NULL || list_empty(head))
-        return;
-
-    size_t len = q_size(head);
-    struct list_head *new = merge_sort(head->next, len);
-    struct list_head *cur = new, *prev = head;
+    struct list_head *cur = first, *prev = head;
 
     while (len-- > 0) {
         cur->prev = prev;
@@ -379,18 +1589,34 @@ void q_sort(struct list_head *head)
         cur = cur->next;
     }
 
-    head->next = new;
+    head->next = first;
     head->prev = prev;
     prev->next = head;
 }
 
+/* Sort elements of queue in ascending order */
+void q_sort(struct list_head *head)
+{
+    if (head == NULL || q_size(head) == 0)
+        return;
+    if (ops_of(head)) {
+        q_array_sort(head);
+        return;
+    }
+
+    settle(head);
+    forget_layout(head);
+    size_t len = q_size(head);
+    relink(head, merge_sort(head->next, len), len);
+}
+
 static struct list_head *merge(struct list_head *a, struct list_head *b)
 {
     // cppcheck-suppress unassignedVariable
     struct list_head *head, **tail = &head;
     while (1) {
-        if (strcmp(list_entry(a, element_t, list)->value,
-                   list_entry(b, element_t, list)->value) <= 0) {
+        if (cmp_element(list_entry(a, element_t, list),
+                        list_entry(b, element_t, list)) <= 0) {
             *tail = a;
             tail = &a->next;
             a = a->next;
@@ -418,8 +1644,8 @@ static void merge_final(struct list_head *head,
     struct list_head *tail = head;
 
     while (1) {
-        if (strcmp(list_entry(a, element_t, list)->value,
-                   list_entry(b, element_t, list)->value) <= 0) {
+        if (cmp_element(list_entry(a, element_t, list),
+                        list_entry(b, element_t, list)) <= 0) {
             tail->next = a;
             a->prev = tail;
             tail = a;
@@ -470,7 +1696,14 @@ static void observe(struct list_head *head)
 
 void q_list_sort(struct list_head *head)
 {
+    if (ops_of(head)) {
+        q_sort(head);
+        return;
+    }
+
     /* Now we can experiment with the cloned queue */
+    settle(head);
+    forget_layout(head);
     struct list_head *list = head->next, *pending = NULL;
     size_t count = 0;
 
@@ -512,33 +1745,469 @@ void q_list_sort(struct list_head *head)
             observe(o);
             o = o->prev;
         }
-        printf("\n");
-#endif
+        printf("\n");
+#endif
+
+    } while (list);
+
+    list = pending;
+    pending = pending->prev;
+
+    for (;;) {
+        struct list_head *next = pending->prev;
+        if (!next)
+            break;
+
+        list = merge(pending, list);
+        pending = next;
+    }
+    merge_final(head, pending, list);
+}
+
+
+
+/* Runs shorter than this are insertion sorted before merging */
+#define ARRAY_SORT_RUN 32
+
+/**
+ * sort_entry_t - Array slot used by q_array_sort
+ * @key: copy of the element key, so most comparisons stay in the array
+ * @e: the element
+ */
+typedef struct {
+    uint64_t key;
+    element_t *e;
+} sort_entry_t;
+
+static inline int cmp_entry(const sort_entry_t *a, const sort_entry_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    return cmp_element(a->e, b->e);
+}
+
+/* Stable bottom-up merge sort of @n entries in @a, using @tmp as the second
+ * buffer. Return whichever of the two ends up holding the result.
+ */
+static sort_entry_t *sort_entries(sort_entry_t *a, sort_entry_t *tmp, size_t n)
+{
+    for (size_t lo = 0; lo < n; lo += ARRAY_SORT_RUN) {
+        size_t hi = lo + ARRAY_SORT_RUN < n ? lo + ARRAY_SORT_RUN : n;
+        for (size_t i = lo + 1; i < hi; i++) {
+            sort_entry_t x = a[i];
+            size_t j = i;
+            for (; j > lo && cmp_entry(&a[j - 1], &x) > 0; j--)
+                a[j] = a[j - 1];
+            a[j] = x;
+        }
+    }
+
+    for (size_t width = ARRAY_SORT_RUN; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                tmp[k++] = cmp_entry(&a[j], &a[i]) < 0 ? a[j++] : a[i++];
+            while (i < mid)
+                tmp[k++] = a[i++];
+            while (j < hi)
+                tmp[k++] = a[j++];
+        }
+        sort_entry_t *swap = a;
+        a = tmp;
+        tmp = swap;
+    }
+    return a;
+}
+
+void q_array_sort(struct list_head *head)
+{
+    if (head == NULL || q_size(head) < 2)
+        return;
+
+    if (!ops_of(head)) {
+        settle(head);
+        forget_layout(head);
+    }
+
+    size_t len = q_size(head);
+    sort_entry_t *entries = test_scratch_alloc(2 * len * sizeof(sort_entry_t));
+    if (!entries) {
+        /* Fall back to the merge sort, which needs no memory */
+        if (!ops_of(head))
+            q_sort(head);
+        else
+            store_linked(head, merge_sort(link_elements(head), len));
+        return;
+    }
+
+    /* The pointers are parked in the upper half until their keys are read */
+    element_t **ptrs = (element_t **) (entries + len);
+    load_array(head, ptrs);
+    for (size_t i = 0; i < len; i++) {
+        entries[i].key = ptrs[i]->key;
+        entries[i].e = ptrs[i];
+    }
+
+    sort_entry_t *sorted = sort_entries(entries, entries + len, len);
+
+    ptrs = (element_t **) (sorted == entries ? entries + len : entries);
+    for (size_t i = 0; i < len; i++)
+        ptrs[i] = sorted[i].e;
+    store_array(head, ptrs, len);
+
+    test_scratch_free(entries);
+}
+
+/* Upper bound of worker threads used by q_parallel_sort */
+#define MAX_SORT_THREADS 64
+
+/* Queues shorter than this are not worth the threads */
+#define PARALLEL_SORT_MIN 8192
+
+/**
+ * sort_task_t - A unit of work for a sort worker
+ * @list: null-terminated run to sort, replaced by the result
+ * @len: number of elements in @list
+ * @other: sorted run to merge into @list, NULL to sort @list instead
+ */
+typedef struct {
+    struct list_head *list;
+    size_t len;
+    struct list_head *other;
+} sort_task_t;
+
+/**
+ * task_pool_t - Tasks shared by a group of sort workers
+ * @tasks: the tasks
+ * @n: number of tasks
+ * @next: index of the first task nobody has claimed yet
+ */
+typedef struct {
+    sort_task_t *tasks;
+    int n;
+    int next;
+} task_pool_t;
+
+static void run_sort_task(sort_task_t *task)
+{
+    if (task->other) {
+        task->list = merge(task->list, task->other);
+    } else {
+        struct list_head *tail = merge_sort(task->list, task->len);
+        task->list = tail;
+        for (size_t i = 1; i < task->len; i++)
+            tail = tail->next;
+        tail->next = NULL;
+    }
+}
+
+static void *sort_worker(void *arg)
+{
+    task_pool_t *pool = arg;
+
+    for (int i; (i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) <
+                pool->n;)
+        run_sort_task(&pool->tasks[i]);
+
+    __atomic_fetch_add(&worker_fallbacks, strcmp_fallbacks, __ATOMIC_RELAXED);
+    strcmp_fallbacks = 0;
+    return NULL;
+}
+
+/* Run @n tasks on up to @nthreads threads, the calling thread included.
+ * Each thread keeps claiming tasks until none are left, so a thread which
+ * failed to start just leaves its share to the others. Workers keep SIGALRM
+ * blocked so the time limit of qtest only ever interrupts the thread which
+ * armed it.
+ */
+static void run_sort_tasks(sort_task_t *tasks, int n, int nthreads)
+{
+    pthread_t tids[MAX_SORT_THREADS];
+    bool started[MAX_SORT_THREADS];
+    task_pool_t pool = {.tasks = tasks, .n = n, .next = 0};
+    sigset_t mask, old;
+
+    if (nthreads > n)
+        nthreads = n;
+    if (nthreads > MAX_SORT_THREADS)
+        nthreads = MAX_SORT_THREADS;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    for (int i = 0; i < nthreads - 1; i++)
+        started[i] = !pthread_create(&tids[i], NULL, sort_worker, &pool);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    sort_worker(&pool);
+    for (int i = 0; i < nthreads - 1; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+}
+
+void q_parallel_sort(struct list_head *head, int nthreads)
+{
+    if (head == NULL || q_size(head) == 0)
+        return;
+
+    size_t len = q_size(head);
+    if (nthreads > MAX_SORT_THREADS)
+        nthreads = MAX_SORT_THREADS;
+    if (nthreads < 2 || len < PARALLEL_SORT_MIN || ops_of(head)) {
+        q_sort(head);
+        return;
+    }
+
+    /* Cut the queue into one null-terminated segment per thread */
+    settle(head);
+    forget_layout(head);
+    sort_task_t tasks[MAX_SORT_THREADS];
+    struct list_head *node = head->next;
+    head->prev->next = NULL;
+    for (int i = 0; i < nthreads; i++) {
+        size_t seg = len / nthreads + ((size_t) i < len % nthreads);
+        tasks[i].list = node;
+        tasks[i].len = seg;
+        tasks[i].other = NULL;
+        for (size_t k = 1; k < seg; k++)
+            node = node->next;
+        struct list_head *next = node->next;
+        node->next = NULL;
+        node = next;
+    }
+    run_sort_tasks(tasks, nthreads, nthreads);
+
+    /* Merge neighbouring runs pairwise until two are left */
+    int runs = nthreads;
+    while (runs > 2) {
+        int pairs = runs / 2;
+        for (int i = 0; i < pairs; i++) {
+            tasks[i].list = tasks[2 * i].list;
+            tasks[i].other = tasks[2 * i + 1].list;
+        }
+        run_sort_tasks(tasks, pairs, pairs);
+        if (runs & 1)
+            tasks[pairs].list = tasks[runs - 1].list;
+        runs = (runs + 1) / 2;
+    }
+    merge_final(head, tasks[0].list, tasks[1].list);
+}
+
+int q_parallel_merge(struct list_head *head, int nthreads)
+{
+    if (!head || list_empty(head))
+        return 0;
+    if (ops_of(list_first_entry(head, queue_contex_t, chain)->q))
+        return q_merge(head);
+
+    struct list_head *q_entry;
+    int k = 0;
+    size_t total = 0;
+
+    list_for_each (q_entry, head) {
+        queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
+        settle(q_ctx->q);
+        forget_layout(q_ctx->q);
+        if (!list_empty(q_ctx->q)) {
+            k++;
+            total += to_queue(q_ctx->q)->size;
+        }
+    }
+
+    sort_task_t *tasks = NULL;
+    if (nthreads > 1 && k > 2)
+        tasks = test_scratch_alloc(k * sizeof(sort_task_t));
+    if (!tasks)
+        return q_merge(head);
+
+    /* Every non-empty queue becomes one null-terminated run */
+    int runs = 0;
+    list_for_each (q_entry, head) {
+        queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
+        struct list_head *q_head = q_ctx->q;
+        q_ctx->size = 0;
+        if (list_empty(q_head))
+            continue;
+
+        tasks[runs++].list = q_head->next;
+        q_head->prev->next = NULL;
+        INIT_LIST_HEAD(q_head);
+        to_queue(q_head)->size = 0;
+    }
+
+    /* Reduce neighbouring runs level by level, so equal values keep the
+     * order of their queues in the chain.
+     */
+    while (runs > 2) {
+        int pairs = runs / 2;
+        for (int i = 0; i < pairs; i++) {
+            tasks[i].list = tasks[2 * i].list;
+            tasks[i].other = tasks[2 * i + 1].list;
+        }
+        run_sort_tasks(tasks, pairs, nthreads);
+        if (runs & 1)
+            tasks[pairs].list = tasks[runs - 1].list;
+        runs = (runs + 1) / 2;
+    }
+
+    queue_contex_t *first_ctx = list_entry(head->next, queue_contex_t, chain);
+    merge_final(first_ctx->q, tasks[0].list, tasks[1].list);
+    to_queue(first_ctx->q)->size = total;
+    first_ctx->size = total;
+    test_scratch_free(tasks);
+    return total;
+}
+
+/* Buckets smaller than this are left to merge_sort */
+#define RADIX_CUTOFF 32
+
+/* Sort the @len elements chained through next from @list, which all share
+ * their first @depth characters, and store the result at @slot.
+ *
+ * Elements are distributed by their character at @depth. Every bucket but
+ * the largest one is sorted recursively, the largest is handled by the next
+ * iteration, so the recursion depth stays logarithmic even for long common
+ * prefixes. Buckets following the largest one are parked in @after until
+ * the elements in front of them are done.
+ *
+ * Return: the next pointer of the last element of the result
+ */
+static struct list_head **radix_sort(struct list_head *list,
+                                     size_t len,
+                                     size_t depth,
+                                     struct list_head **slot)
+{
+    struct list_head *after = NULL, **end = NULL;
+
+    while (len >= RADIX_CUTOFF) {
+        struct list_head *heads[256] = {NULL}, *tails[256];
+        size_t counts[256] = {0}, most = 0;
+        int big = 0;
+
+        for (struct list_head *node = list, *next; node; node = next) {
+            element_t *e = list_entry(node, element_t, list);
+            /* The first 8 characters are read from the cached key */
+            unsigned char c = depth < 8 ? e->key >> (56 - 8 * depth)
+                                        : e->value[depth];
+            next = node->next;
+            if (heads[c])
+                tails[c]->next = node;
+            else
+                heads[c] = node;
+            tails[c] = node;
+            counts[c]++;
+        }
+
+        /* Strings ending here are equal and precede everything else */
+        if (counts[0]) {
+            *slot = heads[0];
+            slot = &tails[0]->next;
+        }
+
+        for (int c = 1; c < 256; c++) {
+            if (counts[c] > most) {
+                most = counts[c];
+                big = c;
+            }
+        }
+        if (big == 0) {
+            len = 0;
+            break;
+        }
 
-    } while (list);
+        for (int c = 1; c < big; c++) {
+            if (!counts[c])
+                continue;
+            tails[c]->next = NULL;
+            slot = radix_sort(heads[c], counts[c], depth + 1, slot);
+        }
 
-    list = pending;
-    pending = pending->prev;
+        struct list_head *rest = NULL, **rest_slot = &rest;
+        for (int c = big + 1; c < 256; c++) {
+            if (!counts[c])
+                continue;
+            tails[c]->next = NULL;
+            rest_slot = radix_sort(heads[c], counts[c], depth + 1, rest_slot);
+        }
+        if (rest) {
+            *rest_slot = after;
+            if (!end)
+                end = rest_slot;
+            after = rest;
+        }
 
-    for (;;) {
-        struct list_head *next = pending->prev;
-        if (!next)
-            break;
+        tails[big]->next = NULL;
+        list = heads[big];
+        len = counts[big];
+        depth++;
+    }
 
-        list = merge(pending, list);
-        pending = next;
+    if (len) {
+        struct list_head *tail = merge_sort(list, len);
+        *slot = tail;
+        while (--len)
+            tail = tail->next;
+        slot = &tail->next;
     }
-    merge_final(head, pending, list);
+    *slot = after;
+    return end ? end : slot;
 }
 
+void q_radix_sort(struct list_head *head)
+{
+    if (head == NULL || q_size(head) < 2)
+        return;
+    if (ops_of(head)) {
+        q_sort(head);
+        return;
+    }
+
+    settle(head);
+    forget_layout(head);
+    struct list_head *first;
+    head->prev->next = NULL;
+    radix_sort(head->next, q_size(head), 0, &first);
+    relink(head, first, q_size(head));
+}
 
+/* Keep the elements which are not less than anything after them. Scanning
+ * from the back, kept ones are swapped to the end of @v.
+ */
+static size_t descend_array(element_t **v, size_t n, void *arg)
+{
+    element_t *max = NULL;
+    size_t first = n;
+
+    for (size_t i = n; i-- > 0;) {
+        element_t *e = v[i];
+        if (!max || cmp_element(e, max) >= 0) {
+            max = e;
+            v[i] = v[--first];
+            v[first] = e;
+        }
+    }
+    release_array(v, first);
+    memmove(v, v + first, (n - first) * sizeof(element_t *));
+    return n - first;
+}
 
 /* Remove every node which has a node with a strictly greater value anywhere to
  * the right side of it */
 int q_descend(struct list_head *head)
 {
+    if (ops_of(head)) {
+        apply_array(head, descend_array, NULL);
+        return q_size(head);
+    }
+
+    settle(head);
+    forget_layout(head);
+
     struct list_head *entry = head->prev, *pprev;
-    char *max = NULL;
+    element_t *max = NULL;
     size_t len = 0;
 
     pprev = entry->prev;
@@ -549,11 +2218,11 @@ int q_descend(struct list_head *head)
             break;
         e = list_entry(entry, element_t, list);
 
-        if (!max || strcmp(e->value, max) >= 0) {
-            max = e->value;
+        if (!max || cmp_element(e, max) >= 0) {
+            max = e;
             len++;
         } else {
-            delete_node(e);
+            delete_node(to_queue(head), e);
         }
         entry = pprev;
         pprev = pprev->prev;
@@ -562,52 +2231,297 @@ int q_descend(struct list_head *head)
     return len;
 }
 
+/**
+ * merge_cursor_t - Position inside one input of the k-way merge
+ * @node: next element to be taken, the input is chained through next
+ * @idx: position of the input in the chain, breaks ties to keep stability
+ */
+typedef struct {
+    struct list_head *node;
+    size_t idx;
+} merge_cursor_t;
+
+static inline bool cursor_less(const merge_cursor_t *a,
+                               const merge_cursor_t *b)
+{
+    int r = cmp_element(list_entry(a->node, element_t, list),
+                        list_entry(b->node, element_t, list));
+    return r < 0 || (r == 0 && a->idx < b->idx);
+}
+
+static void sift_down(merge_cursor_t *heap, size_t n, size_t i)
+{
+    merge_cursor_t x = heap[i];
+
+    for (size_t c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && cursor_less(&heap[c + 1], &heap[c]))
+            c++;
+        if (!cursor_less(&heap[c], &x))
+            break;
+        heap[i] = heap[c];
+    }
+    heap[i] = x;
+}
+
+/* Merge the @k sorted inputs in @heap with a binary min-heap keyed on their
+ * current elements. Return the result chained through next.
+ */
+static struct list_head *merge_k(merge_cursor_t *heap, size_t k)
+{
+    // cppcheck-suppress unassignedVariable
+    struct list_head *head, **tail = &head;
+
+    for (size_t i = k / 2; i-- > 0;)
+        sift_down(heap, k, i);
+
+    while (k > 1) {
+        struct list_head *node = heap[0].node;
+        *tail = node;
+        tail = &node->next;
+        if (node->next)
+            heap[0].node = node->next;
+        else
+            heap[0] = heap[--k];
+        sift_down(heap, k, 0);
+    }
+
+    /* The last input is already in order, take it as a whole */
+    *tail = heap[0].node;
+    return head;
+}
+
+/* Stably merge the @na elements at @a with the @nb at @b into @out */
+static void merge_array(element_t **a,
+                        size_t na,
+                        element_t **b,
+                        size_t nb,
+                        element_t **out)
+{
+    element_t **a_end = a + na, **b_end = b + nb;
+
+    while (a < a_end && b < b_end)
+        *out++ = cmp_element(*b, *a) < 0 ? *b++ : *a++;
+    while (a < a_end)
+        *out++ = *a++;
+    while (b < b_end)
+        *out++ = *b++;
+}
+
+/* q_merge() for backends other than the list. All queues are moved into the
+ * first one, which then holds one sorted run per queue. The runs are merged
+ * pairwise, level by level, between two scratch arrays.
+ *
+ * Should the first queue run out of room, see q_reserve(), the queues which
+ * did not fit are left where they are and only the rest gets merged.
+ */
+/* merge_runs() without scratch memory: fold the queues pairwise as chains
+ * from link_elements(), like q_merge() does without its heap
+ */
+static int merge_linked(struct list_head *head)
+{
+    queue_contex_t *first_ctx = list_entry(head->next, queue_contex_t, chain);
+    queue_t *dst = to_queue(first_ctx->q);
+    const queue_ops_t *ops = ops_of(first_ctx->q);
+    struct list_head *q_entry, *sorted = NULL;
+
+    list_for_each (q_entry, head) {
+        queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
+        struct list_head *run = link_elements(q_ctx->q);
+        if (run && q_ctx->q != &dst->head &&
+            !ops->absorb(dst, to_queue(q_ctx->q)))
+            break;
+        q_ctx->size = 0;
+        if (run)
+            sorted = sorted ? merge(sorted, run) : run;
+    }
+
+    store_linked(&dst->head, sorted);
+    first_ctx->size = dst->size;
+    return dst->size;
+}
+
+static int merge_runs(struct list_head *head)
+{
+    queue_contex_t *first_ctx = list_entry(head->next, queue_contex_t, chain);
+    queue_t *dst = to_queue(first_ctx->q);
+    const queue_ops_t *ops = ops_of(first_ctx->q);
+    struct list_head *q_entry;
+    size_t k = 0, total = 0;
+
+    list_for_each (q_entry, head) {
+        queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
+        if (q_size(q_ctx->q)) {
+            k++;
+            total += q_size(q_ctx->q);
+        }
+    }
+    if (total == 0)
+        return 0;
+
+    /* bound[i] is where run i starts, bound[runs] where the last one ends */
+    size_t *bound = test_scratch_alloc((k + 1) * sizeof(size_t) +
+                                       2 * total * sizeof(element_t *));
+    if (!bound)
+        return merge_linked(head);
+
+    size_t runs = 0;
+    bound[0] = 0;
+    list_for_each (q_entry, head) {
+        queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
+        int len = q_size(q_ctx->q);
+        if (len && q_ctx->q != &dst->head &&
+            !ops->absorb(dst, to_queue(q_ctx->q)))
+            break;
+        q_ctx->size = 0;
+        if (len == 0)
+            continue;
+
+        bound[runs + 1] = bound[runs] + len;
+        runs++;
+    }
+    total = bound[runs];
+
+    element_t **src = (element_t **) (bound + k + 1), **out = src + total;
+    ops->gather(dst, src);
+    while (runs > 1) {
+        size_t merged = 0;
+        for (size_t r = 0; r < runs; r += 2) {
+            size_t lo = bound[r], mid = bound[r + 1];
+            size_t hi = r + 2 <= runs ? bound[r + 2] : mid;
+            merge_array(src + lo, mid - lo, src + mid, hi - mid, out + lo);
+            bound[++merged] = hi;
+        }
+        runs = merged;
+
+        element_t **t = src;
+        src = out;
+        out = t;
+    }
+    ops->scatter(dst, src, total);
+    test_scratch_free(bound);
+
+    first_ctx->size = total;
+    return total;
+}
+
 /* Merge all the queues into one sorted queue, which is in ascending order */
 int q_merge(struct list_head *head)
 {
-    LIST_HEAD(mq);
-    struct list_head *mqc = &mq;
-    struct list_head *q_entry, *entry, *safe;
+    if (!head || list_empty(head))
+        return 0;
+    if (ops_of(list_first_entry(head, queue_contex_t, chain)->q))
+        return merge_runs(head);
+
+    struct list_head *q_entry;
+    size_t k = 0, total = 0;
+
+    list_for_each (q_entry, head) {
+        queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
+        settle(q_ctx->q);
+        forget_layout(q_ctx->q);
+        if (!list_empty(q_ctx->q)) {
+            k++;
+            total += to_queue(q_ctx->q)->size;
+        }
+    }
+
+    /* Every queue was empty, nothing to relink */
+    if (total == 0)
+        return 0;
+
+    /* Without scratch memory for the heap, fold the inputs pairwise */
+    merge_cursor_t *heap = test_scratch_alloc(k * sizeof(merge_cursor_t));
+    struct list_head *sorted = NULL;
+    size_t n = 0;
 
-    /* Merge elements in each queue into one queue */
     list_for_each (q_entry, head) {
         queue_contex_t *q_ctx = list_entry(q_entry, queue_contex_t, chain);
         struct list_head *q_head = q_ctx->q;
-        list_for_each_safe (entry, safe, q_head) {
-            mqc->next = entry;
-            mqc = mqc->next;
-            list_del(entry);
+        q_ctx->size = 0;
+        if (list_empty(q_head))
+            continue;
+
+        struct list_head *first = q_head->next;
+        q_head->prev->next = NULL;
+        INIT_LIST_HEAD(q_head);
+        to_queue(q_head)->size = 0;
+
+        if (heap) {
+            heap[n].node = first;
+            heap[n].idx = n;
+            n++;
+        } else {
+            sorted = sorted ? merge(sorted, first) : first;
         }
     }
 
-    /* Replace the head pointer */
-    struct list_head *first_queue =
-        list_entry(head->next, queue_contex_t, chain)->q;
-    first_queue->next = mq.next;
-    first_queue->prev = mqc;
-    mq.next->prev = first_queue;
-    mqc->next = first_queue;
+    if (heap) {
+        sorted = merge_k(heap, n);
+        test_scratch_free(heap);
+    }
+
+    queue_contex_t *first_ctx = list_entry(head->next, queue_contex_t, chain);
+    relink(first_ctx->q, sorted, total);
+    to_queue(first_ctx->q)->size = total;
+    first_ctx->size = total;
+    return total;
+}
+
+/* Random words are drawn in batches of this many when the shuffle cannot
+ * get a scratch buffer.
+ */
+#define SHUFFLE_STACK_BATCH 64
+
+/* Upper bound of random words fetched by one call to randombytes */
+#define SHUFFLE_BATCH 4096
 
+/**
+ * rand_pool_t - Random words fetched from randombytes a batch at a time
+ * @buf: the words
+ * @cap: capacity of @buf
+ * @pos: index of the next unused word, @cap once the batch is used up
+ */
+typedef struct {
+    uint64_t *buf;
+    size_t cap, pos;
+} rand_pool_t;
+
+/* Return a uniformly distributed value in [0, @bound) */
+static uint64_t rand_below(rand_pool_t *rp, uint64_t bound)
+{
+    /* The lowest 2^64 % bound words are rejected, leaving a range that is
+     * a multiple of @bound, so the modulo introduces no bias.
+     */
+    uint64_t threshold = -bound % bound;
 
-    q_sort(first_queue);
-    return q_size(first_queue);
+    while (1) {
+        if (rp->pos == rp->cap) {
+            randombytes((uint8_t *) rp->buf, rp->cap * sizeof(uint64_t));
+            rp->pos = 0;
+        }
+        uint64_t r = rp->buf[rp->pos++];
+        if (r >= threshold)
+            return r % bound;
+    }
 }
 
-void q_shuffle(struct list_head *head)
+/* Shuffle by walking to every target, used when no scratch buffer is
+ * available. Quadratic, but it needs no memory beyond the stack.
+ */
+static void shuffle_walk(struct list_head *head, size_t len)
 {
-    size_t rand;
-    size_t len = q_size(head);
+    uint64_t words[SHUFFLE_STACK_BATCH];
+    rand_pool_t rp = {.buf = words,
+                      .cap = SHUFFLE_STACK_BATCH,
+                      .pos = SHUFFLE_STACK_BATCH};
     size_t idx = 0;
     struct list_head *ent = head->next;
     LIST_HEAD(tmp);
 
-
     while (idx < len) {
         size_t tidx = 0;
         struct list_head *target = ent;
-
-        randombytes((uint8_t *) &rand, sizeof(rand));
-        rand = rand % (len - idx);
+        size_t rand = rand_below(&rp, len - idx);
 
         while (tidx++ != rand) {
             target = target->next;
@@ -644,3 +2558,571 @@ void q_shuffle(struct list_head *head)
         idx++;
     }
 }
+
+void q_shuffle(struct list_head *head)
+{
+    if (!head || q_size(head) < 2)
+        return;
+    if (!ops_of(head)) {
+        settle(head);
+        forget_layout(head);
+    }
+
+    size_t len = q_size(head);
+    size_t batch = len < SHUFFLE_BATCH ? len : SHUFFLE_BATCH;
+    uint64_t *words = test_scratch_alloc(batch * sizeof(uint64_t) +
+                                         len * sizeof(element_t *));
+    if (!words) {
+        if (!ops_of(head))
+            shuffle_walk(head, len);
+        return;
+    }
+
+    rand_pool_t rp = {.buf = words, .cap = batch, .pos = batch};
+    element_t **v = (element_t **) (words + batch);
+    load_array(head, v);
+
+    /* Fisher-Yates: fix the slots from the back, each from what is left */
+    for (size_t i = len - 1; i > 0; i--) {
+        size_t j = rand_below(&rp, i + 1);
+        element_t *t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+    }
+
+    store_array(head, v, len);
+    test_scratch_free(words);
+}
+
+/* Snapshots, see q_save(). Every integer is stored little-endian:
+ *
+ *   header   magic "LAB0SNAP", u32 version, u32 number of queues,
+ *            u64 number of strings, u64 bytes of all strings together,
+ *            u64 number of elements
+ *   index    for each distinct string, u64 offset of its bytes from the
+ *            start of the file and the u64 key of element_t
+ *   strings  for each distinct string, u32 length, the bytes and a
+ *            terminating NUL
+ *   queues   for each queue in chain order, u64 length and one u32 string
+ *            number per element, from head to tail
+ *
+ * The index and the terminators let q_map() use a string right where it
+ * lies in the file, reading no more than the bytes it checks the key
+ * against. q_load() only reads the strings.
+ */
+static const char snap_magic[8] = "LAB0SNAP";
+#define SNAP_VERSION 2
+#define SNAP_HEADER_SIZE 40
+#define SNAP_INDEX_ENTRY 16
+
+/* Bytes of stdio buffer behind a snapshot file */
+#define SNAP_IO_BUFSIZE (1 << 20)
+
+/* String numbers converted at once between the file and the queues */
+#define SNAP_BATCH 4096
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8 * i);
+}
+
+static inline void put_le64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = v >> (8 * i);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static inline uint64_t get_le64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+/* Open @path with a large buffer of its own, stored in @buf */
+static FILE *snap_open(const char *path, const char *mode, void **buf)
+{
+    FILE *f = fopen(path, mode);
+    if (!f)
+        return NULL;
+
+    *buf = test_scratch_alloc(SNAP_IO_BUFSIZE);
+    if (*buf)
+        setvbuf(f, *buf, _IOFBF, SNAP_IO_BUFSIZE);
+    return f;
+}
+
+/* Create a temporary file next to @path, with a large buffer like
+ * snap_open(). Its name goes to @tmp, for q_save() to rename it over
+ * @path once written, so that mappings of the old file keep their inode.
+ */
+static FILE *snap_create(const char *path, char **tmp, void **buf)
+{
+    size_t len = strlen(path);
+    *tmp = test_scratch_alloc(len + sizeof(".XXXXXX"));
+    if (!*tmp)
+        return NULL;
+    memcpy(*tmp, path, len);
+    memcpy(*tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int fd = mkstemp(*tmp);
+    if (fd < 0) {
+        test_scratch_free(*tmp);
+        *tmp = NULL;
+        return NULL;
+    }
+
+    /* mkstemp() makes the file private, fopen() would not have */
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(*tmp);
+        test_scratch_free(*tmp);
+        *tmp = NULL;
+        return NULL;
+    }
+
+    *buf = test_scratch_alloc(SNAP_IO_BUFSIZE);
+    if (*buf)
+        setvbuf(f, *buf, _IOFBF, SNAP_IO_BUFSIZE);
+    return f;
+}
+
+/* Close a file from snap_open(), telling whether everything went through */
+static bool snap_close(FILE *f, void *buf)
+{
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    test_scratch_free(buf);
+    return ok;
+}
+
+/**
+ * snap_slot_t - Slot of the table interning the strings of a snapshot
+ * @id: number of the string plus one, 0 for an empty slot
+ * @hash: upper half of the hash of the string
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t hash;
+} snap_slot_t;
+
+/* Number every distinct string of the @n elements of @head after the
+ * @nstr already in @uniq, writing each number to @ids and the bytes of new
+ * strings to @bytes
+ */
+static void snap_intern(struct list_head *head,
+                        snap_slot_t *table,
+                        size_t mask,
+                        element_t **uniq,
+                        size_t *nstr,
+                        uint64_t *bytes,
+                        uint32_t *ids)
+{
+    q_iter_t it;
+    for (element_t *e = q_iter_first(head, &it); e; e = q_iter_next(&it)) {
+        uint64_t h = hash_string(e->value);
+        snap_slot_t *slot;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            slot = &table[i];
+            if (!slot->id)
+                break;
+
+            element_t *u = uniq[slot->id - 1];
+            if (slot->hash == (uint32_t) (h >> 32) && u->key == e->key &&
+                !strcmp(u->value, e->value))
+                break;
+        }
+        if (!slot->id) {
+            uniq[*nstr] = e;
+            slot->id = ++*nstr;
+            slot->hash = h >> 32;
+            *bytes += strlen(e->value);
+        }
+        *ids++ = slot->id - 1;
+    }
+}
+
+bool q_save(struct list_head *chain, const char *path)
+{
+    if (chain == NULL || path == NULL)
+        return false;
+
+    queue_contex_t *ctx;
+    size_t nq = 0, total = 0;
+    list_for_each_entry (ctx, chain, chain) {
+        nq++;
+        total += q_size(ctx->q);
+    }
+    if (nq > UINT32_MAX || total > UINT32_MAX)
+        return false;
+
+    size_t cap = 16;
+    while (cap < 2 * total)
+        cap <<= 1;
+    snap_slot_t *table = test_scratch_alloc(cap * sizeof(snap_slot_t));
+    element_t **uniq = test_scratch_alloc(total * sizeof(element_t *) + 1);
+    uint32_t *ids = test_scratch_alloc(total * sizeof(uint32_t) + 1);
+    bool ok = table && uniq && ids;
+    if (!ok)
+        goto out;
+
+    /* Number the strings first, the header has to count them */
+    memset(table, 0, cap * sizeof(snap_slot_t));
+    size_t nstr = 0, at = 0;
+    uint64_t bytes = 0;
+    list_for_each_entry (ctx, chain, chain) {
+        snap_intern(ctx->q, table, cap - 1, uniq, &nstr, &bytes, ids + at);
+        at += q_size(ctx->q);
+    }
+
+    void *buf = NULL;
+    char *tmp = NULL;
+    FILE *f = snap_create(path, &tmp, &buf);
+    if (!f) {
+        ok = false;
+        goto out;
+    }
+
+    uint8_t header[SNAP_HEADER_SIZE];
+    memcpy(header, snap_magic, sizeof(snap_magic));
+    put_le32(header + 8, SNAP_VERSION);
+    put_le32(header + 12, nq);
+    put_le64(header + 16, nstr);
+    put_le64(header + 24, bytes);
+    put_le64(header + 32, total);
+    fwrite(header, sizeof(header), 1, f);
+
+    /* Each string lies after its length, past the index */
+    uint64_t off = SNAP_HEADER_SIZE + (uint64_t) nstr * SNAP_INDEX_ENTRY;
+    for (size_t i = 0; i < nstr; i++) {
+        uint8_t entry[SNAP_INDEX_ENTRY];
+        put_le64(entry, off + 4);
+        put_le64(entry + 8, uniq[i]->key);
+        fwrite(entry, sizeof(entry), 1, f);
+        off += 4 + strlen(uniq[i]->value) + 1;
+    }
+
+    for (size_t i = 0; i < nstr; i++) {
+        uint8_t len[4];
+        size_t n = strlen(uniq[i]->value);
+        put_le32(len, n);
+        fwrite(len, sizeof(len), 1, f);
+        fwrite(uniq[i]->value, 1, n + 1, f);
+    }
+
+    uint8_t out[4 * SNAP_BATCH];
+    at = 0;
+    list_for_each_entry (ctx, chain, chain) {
+        size_t n = q_size(ctx->q);
+        put_le64(out, n);
+        fwrite(out, 8, 1, f);
+        for (size_t done = 0; done < n;) {
+            size_t k = n - done < SNAP_BATCH ? n - done : SNAP_BATCH;
+            for (size_t i = 0; i < k; i++)
+                put_le32(out + 4 * i, ids[at + done + i]);
+            fwrite(out, 4, k, f);
+            done += k;
+        }
+        at += n;
+    }
+    ok = snap_close(f, buf) && rename(tmp, path) == 0;
+    if (!ok)
+        unlink(tmp);
+    test_scratch_free(tmp);
+
+out:
+    test_scratch_free(ids);
+    test_scratch_free(uniq);
+    test_scratch_free(table);
+    return ok;
+}
+
+/* Append the elements of one saved queue to @head, reading the numbers of
+ * their strings from @f
+ */
+static bool snap_fill(FILE *f,
+                      struct list_head *head,
+                      char **strs,
+                      size_t nstr)
+{
+    uint8_t in[4 * SNAP_BATCH];
+    char *sv[SNAP_BATCH];
+
+    if (fread(in, 8, 1, f) != 1)
+        return false;
+
+    uint64_t n = get_le64(in);
+    for (uint64_t done = 0; done < n;) {
+        int k = n - done < SNAP_BATCH ? n - done : SNAP_BATCH;
+        if (fread(in, 4, k, f) != (size_t) k)
+            return false;
+        for (int i = 0; i < k; i++) {
+            uint32_t id = get_le32(in + 4 * i);
+            if (id >= nstr)
+                return false;
+            sv[i] = strs[id];
+        }
+        if (!q_insert_tail_bulk(head, sv, k, k))
+            return false;
+        done += k;
+    }
+    return true;
+}
+
+int q_load(const char *path,
+           struct list_head *(*add_queue)(void *arg),
+           void *arg)
+{
+    if (path == NULL || add_queue == NULL)
+        return -1;
+
+    void *buf = NULL;
+    FILE *f = snap_open(path, "rb", &buf);
+    if (!f)
+        return -1;
+
+    int loaded = -1;
+    char **strs = NULL, *blob = NULL;
+    uint8_t header[SNAP_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, f) != 1 ||
+        memcmp(header, snap_magic, sizeof(snap_magic)) ||
+        get_le32(header + 8) != SNAP_VERSION)
+        goto out;
+
+    uint32_t nq = get_le32(header + 12);
+    uint64_t nstr = get_le64(header + 16), bytes = get_le64(header + 24);
+    if (nstr > get_le64(header + 32) || nstr > SIZE_MAX / sizeof(char *) ||
+        nstr > LONG_MAX / SNAP_INDEX_ENTRY || bytes > SIZE_MAX - nstr ||
+        fseek(f, nstr * SNAP_INDEX_ENTRY, SEEK_CUR))
+        goto out;
+
+    /* Every string keeps its terminator, all in one block */
+    strs = test_scratch_alloc(nstr * sizeof(char *) + 1);
+    blob = test_scratch_alloc(bytes + nstr + 1);
+    if (!strs || !blob)
+        goto out;
+
+    char *p = blob, *end = blob + bytes + nstr;
+    for (uint64_t i = 0; i < nstr; i++) {
+        uint8_t len[4];
+        if (fread(len, sizeof(len), 1, f) != 1)
+            goto out;
+        uint32_t n = get_le32(len);
+        if (n >= (size_t) (end - p) || fread(p, 1, n + 1, f) != n + 1 ||
+            p[n])
+            goto out;
+        strs[i] = p;
+        p += n + 1;
+    }
+
+    loaded = 0;
+    for (uint32_t i = 0; i < nq; i++) {
+        struct list_head *head = add_queue(arg);
+        if (!head || !snap_fill(f, head, strs, nstr)) {
+            loaded = -1;
+            break;
+        }
+        loaded++;
+    }
+
+out:
+    test_scratch_free(blob);
+    test_scratch_free(strs);
+    snap_close(f, buf);
+    return loaded;
+}
+
+/**
+ * snap_image_t - Snapshot file mapped by q_map()
+ * @base: start of the mapping
+ * @len: bytes mapped, the whole file
+ * @nstr: number of distinct strings
+ * @strings: offset of the strings, right after the index
+ * @queues: offset of the queues, right after the strings
+ * @refs: elements whose value points into the mapping, plus one while
+ *        q_map() is still filling queues
+ * @next: next image still mapped
+ */
+typedef struct snap_image {
+    uint8_t *base;
+    size_t len;
+    uint64_t nstr;
+    size_t strings;
+    size_t queues;
+    size_t refs;
+    struct snap_image *next;
+} snap_image_t;
+
+/* Every image some element still points into */
+static snap_image_t *images = NULL;
+
+/* Drop a reference to @img, unmapping it with the last one */
+static void image_put(snap_image_t *img)
+{
+    if (--img->refs)
+        return;
+
+    snap_image_t **link = &images;
+    while (*link != img)
+        link = &(*link)->next;
+    *link = img->next;
+    munmap(img->base, img->len);
+    free(img);
+}
+
+void q_release_mapped(char *value)
+{
+    const uint8_t *p = (const uint8_t *) value;
+    for (snap_image_t *img = images; img; img = img->next) {
+        if (p >= img->base && p < img->base + img->len) {
+            image_put(img);
+            return;
+        }
+    }
+}
+
+/* Element for string @id of @img, its value left in the mapping */
+static element_t *map_element(snap_image_t *img, uint32_t id)
+{
+    if (id >= img->nstr)
+        return NULL;
+
+    /* The last string ends with a NUL, so none can run past the strings */
+    const uint8_t *entry = img->base + SNAP_HEADER_SIZE + id * SNAP_INDEX_ENTRY;
+    uint64_t off = get_le64(entry);
+    if (off < img->strings || off >= img->queues)
+        return NULL;
+
+    /* Sorting and searching trust the key, so a file whose key does not
+     * match its string is refused rather than left to misorder the queue
+     */
+    char *value = (char *) img->base + off;
+    uint64_t key = key_of(value);
+    if (key != get_le64(entry + 8))
+        return NULL;
+
+    element_t *e = pool_alloc(sizeof(element_t));
+    if (!e)
+        return NULL;
+
+    e->value = value;
+    e->key = key;
+    e->inline_value[0] = 1;
+    img->refs++;
+    return e;
+}
+
+/* Append the elements of the saved queue at *@pos in @img to @head, and
+ * move *@pos past it
+ */
+static bool map_fill(snap_image_t *img, size_t *pos, struct list_head *head)
+{
+    element_t *v[SNAP_BATCH];
+
+    if (img->len - *pos < 8)
+        return false;
+    uint64_t n = get_le64(img->base + *pos);
+    *pos += 8;
+    if (n > (img->len - *pos) / 4)
+        return false;
+
+    for (uint64_t done = 0; done < n;) {
+        size_t k = n - done < SNAP_BATCH ? n - done : SNAP_BATCH;
+        for (size_t i = 0; i < k; i++) {
+            v[i] = map_element(img, get_le32(img->base + *pos + 4 * i));
+            if (!v[i]) {
+                while (i-- > 0)
+                    q_release_element(v[i]);
+                return false;
+            }
+        }
+        if (!append_elements(head, v, k)) {
+            for (size_t i = 0; i < k; i++)
+                q_release_element(v[i]);
+            return false;
+        }
+        *pos += 4 * k;
+        done += k;
+    }
+    return true;
+}
+
+int q_map(const char *path,
+          struct list_head *(*add_queue)(void *arg),
+          void *arg)
+{
+    if (path == NULL || add_queue == NULL)
+        return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= SNAP_HEADER_SIZE)
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    snap_image_t *img = malloc(sizeof(snap_image_t));
+    if (!img) {
+        munmap(base, st.st_size);
+        return -1;
+    }
+    img->base = base;
+    img->len = st.st_size;
+    img->refs = 1;
+    img->next = images;
+    images = img;
+
+    int mapped = -1;
+    const uint8_t *header = img->base;
+    if (memcmp(header, snap_magic, sizeof(snap_magic)) ||
+        get_le32(header + 8) != SNAP_VERSION)
+        goto out;
+
+    /* The index and the strings have to fit in the file */
+    uint32_t nq = get_le32(header + 12);
+    uint64_t nstr = get_le64(header + 16), bytes = get_le64(header + 24);
+    size_t room = img->len - SNAP_HEADER_SIZE;
+    if (nstr > room / (SNAP_INDEX_ENTRY + 5) ||
+        bytes > room - nstr * (SNAP_INDEX_ENTRY + 5))
+        goto out;
+    img->nstr = nstr;
+    img->strings = SNAP_HEADER_SIZE + nstr * SNAP_INDEX_ENTRY;
+    img->queues = img->strings + nstr * 5 + bytes;
+    if (nstr && img->base[img->queues - 1])
+        goto out;
+
+    mapped = 0;
+    size_t pos = img->queues;
+    for (uint32_t i = 0; i < nq; i++) {
+        struct list_head *head = add_queue(arg);
+        if (!head || !map_fill(img, &pos, head)) {
+            mapped = -1;
+            break;
+        }
+        mapped++;
+    }
+
+out:
+    image_put(img);
+    return mapped;
+}
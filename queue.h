@@ -9,22 +9,90 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
+#include "pool.h"
+
+/* Strings shorter than this are kept inside the element itself */
+#define Q_INLINE_LEN 24
 
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
+ * @key: the first 8 bytes of @value as a big-endian integer, zero padded
+ * @inline_value: storage for short strings
+ *
+ * @value points to @inline_value when the string fits, so the common case
+ * costs a single allocation. Longer strings are allocated separately and
+ * have to be freed explicitly. Both come from the element pool, see pool.h.
+ *
+ * Elements made by q_map() instead point @value into a read-only mapping
+ * of a snapshot file, whatever the length, and mark that with a nonzero
+ * first byte of @inline_value, which is otherwise unused then.
  *
- * @value needs to be explicitly allocated and freed
+ * Comparing @key orders two elements like strcmp() does whenever their
+ * first 8 bytes differ, without touching @value.
  */
 typedef struct {
     char *value;
     struct list_head list;
+    uint64_t key;
+    char inline_value[Q_INLINE_LEN];
 } element_t;
 
+/* Storage layouts a queue can use, see q_set_backend() */
+enum {
+    Q_BACKEND_LIST,  /* elements linked through element_t.list */
+    Q_BACKEND_CHUNK, /* element pointers kept in linked chunks */
+    Q_BACKEND_RING,  /* element pointers kept in a growable ring buffer */
+    Q_BACKEND_COUNT,
+};
+
+/**
+ * queue_t - Header of a queue
+ * @head: sentinel of the circular list, handed out as the queue itself
+ * @size: the number of elements in the queue
+ * @backend: storage layout, fixed when the queue is created
+ * @finger: node of the element q_insert_sorted() added last, NULL when
+ *          unknown. Only used by the list backend.
+ * @index: skip-list index over the elements, NULL unless q_set_index()
+ *         enabled it. Only used by the list backend, see skiplist.h.
+ * @reversed: the elements are linked from the tail to the head, so that
+ *            q_reverse() only has to flip this. Only used by the list
+ *            backend.
+ * @mid: node of the element at position @size / 2, the one q_delete_mid()
+ *       deletes, NULL when unknown. Only used by the list backend.
+ *
+ * With Q_BACKEND_LIST the elements are linked after @head. Other backends
+ * embed queue_t in a larger header and link their own storage after @head,
+ * leaving element_t.list unused.
+ *
+ * With @reversed set, @head->next is the last element of the queue and
+ * every link points the other way round. The operations which only touch
+ * the ends, and the iterators in custom.h, follow the links accordingly.
+ * Those which walk the whole chain first put it back in order, which costs
+ * no more than the walk itself.
+ *
+ * @finger, @index and @mid are only hints which an operation may drop when
+ * it rearranges the queue. The next operation which needs one of them
+ * pays to find it again.
+ *
+ * Every operation which adds or removes an element keeps @size exact, so
+ * q_size() never has to walk the queue.
+ */
+typedef struct {
+    struct list_head head;
+    int size;
+    int backend;
+    struct list_head *finger;
+    struct skip_index *index;
+    bool reversed;
+    struct list_head *mid;
+} queue_t;
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -108,6 +176,15 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_release_mapped() - Drop the reference a value holds on its mapping
+ * @value: value of an element made by q_map()
+ *
+ * The mapping goes away with the last element pointing into it.
+ * This function is intended for internal use only.
+ */
+void q_release_mapped(char *value);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
@@ -116,8 +193,13 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
-    test_free(e);
+    if (e->value != e->inline_value) {
+        if (e->inline_value[0])
+            q_release_mapped(e->value);
+        else
+            pool_free(e->value);
+    }
+    pool_free(e);
 }
 
 /**
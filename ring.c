@@ -0,0 +1,351 @@
+#include <string.h>
+
+#include "backend.h"
+
+/* Ring buffer backend: element pointers live in one power-of-two array.
+ *
+ * Elements are addressed by virtual positions which only ever move by one
+ * at either end; position p lives in slot p & mask, so both ends grow and
+ * shrink in O(1) without moving anything.
+ *
+ * A full buffer is replaced by one twice as large, but its contents are not
+ * copied at once. The old buffer stays around and every later insertion or
+ * removal moves RING_MIGRATE_STEP elements over, so no single operation
+ * pays for the whole copy. Elements not moved yet occupy the positions
+ * [lo, hi) and are still read from the old buffer. The new buffer has room
+ * for as many insertions as the old one held elements, more than enough
+ * for the copy to finish first. Allocating it still costs one pass over
+ * the new capacity, since test_malloc() fills every block it returns.
+ */
+
+/* Slots allocated for an empty queue */
+#define RING_MIN_CAP 8
+
+/* Elements moved to the new buffer by every insertion or removal */
+#define RING_MIGRATE_STEP 2
+
+/**
+ * ring_t - Header of a ring buffer queue
+ * @q: the generic header, q.size counts the elements
+ * @buf: the slots, @mask + 1 of them
+ * @mask: capacity minus one
+ * @front: virtual position of the first element
+ * @old: buffer still being drained after a resize, NULL if none
+ * @old_mask: capacity of @old minus one
+ * @lo: first position still only held by @old
+ * @hi: position after the last one still only held by @old
+ */
+typedef struct {
+    queue_t q;
+    element_t **buf;
+    size_t mask;
+    size_t front;
+    element_t **old;
+    size_t old_mask;
+    size_t lo, hi;
+} ring_t;
+
+#define ring_of(queue) container_of(queue, ring_t, q)
+
+/* Where the element at virtual position @p is stored */
+static inline element_t **ring_slot(ring_t *r, size_t p)
+{
+    if (r->old && p - r->lo < r->hi - r->lo)
+        return &r->old[p & r->old_mask];
+    return &r->buf[p & r->mask];
+}
+
+static void ring_migrate(ring_t *r)
+{
+    if (!r->old)
+        return;
+
+    for (int i = 0; i < RING_MIGRATE_STEP && r->lo != r->hi; i++, r->lo++)
+        r->buf[r->lo & r->mask] = r->old[r->lo & r->old_mask];
+    if (r->lo == r->hi) {
+        free(r->old);
+        r->old = NULL;
+    }
+}
+
+/* Switch to a buffer twice as large, leaving the copy to ring_migrate() */
+static bool ring_grow(ring_t *r)
+{
+    /* ring_absorb() fills the buffer without migrating anything, so the
+     * copy of the previous resize may not be over yet
+     */
+    while (r->old)
+        ring_migrate(r);
+
+    size_t cap = 2 * (r->mask + 1);
+    element_t **buf = malloc(cap * sizeof(element_t *));
+    if (!buf)
+        return false;
+
+    r->old = r->buf;
+    r->old_mask = r->mask;
+    r->lo = r->front;
+    r->hi = r->front + r->q.size;
+    r->buf = buf;
+    r->mask = cap - 1;
+    return true;
+}
+
+static queue_t *ring_create(void)
+{
+    ring_t *r = malloc(sizeof(ring_t));
+    if (!r)
+        return NULL;
+
+    r->buf = malloc(RING_MIN_CAP * sizeof(element_t *));
+    if (!r->buf) {
+        free(r);
+        return NULL;
+    }
+
+    INIT_LIST_HEAD(&r->q.head);
+    r->q.size = 0;
+    r->q.backend = Q_BACKEND_RING;
+    r->mask = RING_MIN_CAP - 1;
+    r->front = 0;
+    r->old = NULL;
+    return &r->q;
+}
+
+static void ring_destroy(queue_t *q)
+{
+    ring_t *r = ring_of(q);
+
+    free(r->old);
+    free(r->buf);
+    free(r);
+}
+
+static bool ring_push_head(queue_t *q, element_t *e)
+{
+    ring_t *r = ring_of(q);
+
+    if ((size_t) q->size > r->mask && !ring_grow(r))
+        return false;
+
+    r->buf[--r->front & r->mask] = e;
+    q->size++;
+    ring_migrate(r);
+    return true;
+}
+
+static bool ring_push_tail(queue_t *q, element_t *e)
+{
+    ring_t *r = ring_of(q);
+
+    if ((size_t) q->size > r->mask && !ring_grow(r))
+        return false;
+
+    r->buf[(r->front + q->size) & r->mask] = e;
+    q->size++;
+    ring_migrate(r);
+    return true;
+}
+
+static element_t *ring_pop_head(queue_t *q)
+{
+    ring_t *r = ring_of(q);
+
+    if (q->size == 0)
+        return NULL;
+
+    element_t *e = *ring_slot(r, r->front);
+    if (r->old && r->lo == r->front && r->lo != r->hi)
+        r->lo++;
+    r->front++;
+    q->size--;
+    ring_migrate(r);
+    return e;
+}
+
+static element_t *ring_pop_tail(queue_t *q)
+{
+    ring_t *r = ring_of(q);
+
+    if (q->size == 0)
+        return NULL;
+
+    size_t last = r->front + q->size - 1;
+    element_t *e = *ring_slot(r, last);
+    if (r->old && r->hi - 1 == last && r->lo != r->hi)
+        r->hi--;
+    q->size--;
+    ring_migrate(r);
+    return e;
+}
+
+static void ring_gather(queue_t *q, element_t **out)
+{
+    ring_t *r = ring_of(q);
+
+    for (size_t i = 0; i < (size_t) q->size; i++)
+        out[i] = *ring_slot(r, r->front + i);
+}
+
+static void ring_scatter(queue_t *q, element_t **in, size_t n)
+{
+    ring_t *r = ring_of(q);
+
+    for (size_t i = 0; i < n; i++)
+        *ring_slot(r, r->front + i) = in[i];
+
+    /* Positions past the new end no longer need copying */
+    if (r->old && r->hi - r->front > n) {
+        r->hi = r->front + n;
+        if (r->lo - r->front > n)
+            r->lo = r->hi;
+    }
+    q->size = n;
+}
+
+static bool ring_absorb(queue_t *dst, queue_t *src)
+{
+    ring_t *d = ring_of(dst), *s = ring_of(src);
+
+    if ((size_t) dst->size + src->size > d->mask + 1)
+        return false;
+
+    for (size_t i = 0; i < (size_t) src->size; i++)
+        d->buf[(d->front + dst->size + i) & d->mask] =
+            *ring_slot(s, s->front + i);
+    dst->size += src->size;
+
+    /* Whatever @src still had to copy is gone with its elements */
+    src->size = 0;
+    if (s->old)
+        s->lo = s->hi;
+    return true;
+}
+
+static bool ring_reserve(queue_t *q, size_t n)
+{
+    ring_t *r = ring_of(q);
+
+    if (n <= r->mask + 1)
+        return true;
+
+    size_t cap = r->mask + 1;
+    while (cap < n)
+        cap <<= 1;
+    element_t **buf = malloc(cap * sizeof(element_t *));
+    if (!buf)
+        return false;
+
+    /* An explicit reservation may copy everything at once */
+    for (size_t i = 0; i < (size_t) q->size; i++)
+        buf[(r->front + i) & (cap - 1)] = *ring_slot(r, r->front + i);
+    free(r->old);
+    free(r->buf);
+    r->old = NULL;
+    r->buf = buf;
+    r->mask = cap - 1;
+    return true;
+}
+
+static inline void swap_positions(ring_t *r, size_t a, size_t b)
+{
+    element_t **pa = ring_slot(r, a), **pb = ring_slot(r, b);
+    element_t *t = *pa;
+    *pa = *pb;
+    *pb = t;
+}
+
+/* Reverse the @len elements starting at position @from */
+static void reverse_range(ring_t *r, size_t from, size_t len)
+{
+    for (size_t i = 0; i < len / 2; i++)
+        swap_positions(r, from + i, from + len - 1 - i);
+}
+
+static void ring_reverse(queue_t *q)
+{
+    ring_t *r = ring_of(q);
+    reverse_range(r, r->front, q->size);
+}
+
+static void ring_swap(queue_t *q)
+{
+    ring_t *r = ring_of(q);
+
+    for (size_t i = 0; i + 1 < (size_t) q->size; i += 2)
+        swap_positions(r, r->front + i, r->front + i + 1);
+}
+
+static void ring_reverse_k(queue_t *q, int k)
+{
+    ring_t *r = ring_of(q);
+
+    if (k <= 1)
+        return;
+    for (size_t i = 0; i + k <= (size_t) q->size; i += k)
+        reverse_range(r, r->front + i, k);
+}
+
+static element_t *ring_iter_first(queue_t *q, q_iter_t *it, bool backward)
+{
+    ring_t *r = ring_of(q);
+
+    it->head = &q->head;
+    it->node = NULL;
+    if (q->size == 0)
+        return NULL;
+
+    it->idx = backward ? r->front + q->size - 1 : r->front;
+    return *ring_slot(r, it->idx);
+}
+
+static element_t *ring_iter_step(q_iter_t *it, bool backward)
+{
+    ring_t *r = ring_of(list_entry(it->head, queue_t, head));
+
+    if (backward) {
+        if (it->idx == r->front)
+            return NULL;
+        it->idx--;
+    } else {
+        if (it->idx + 1 - r->front >= (size_t) r->q.size)
+            return NULL;
+        it->idx++;
+    }
+    return *ring_slot(r, it->idx);
+}
+
+static element_t *ring_iter_at(queue_t *q, q_iter_t *it, size_t rank)
+{
+    ring_t *r = ring_of(q);
+
+    it->head = &q->head;
+    it->node = NULL;
+    it->idx = r->front + rank;
+    return *ring_slot(r, it->idx);
+}
+
+static void ring_iter_store(q_iter_t *it, element_t *e)
+{
+    *ring_slot(ring_of(list_entry(it->head, queue_t, head)), it->idx) = e;
+}
+
+const queue_ops_t ring_ops = {
+    .create = ring_create,
+    .destroy = ring_destroy,
+    .push_head = ring_push_head,
+    .push_tail = ring_push_tail,
+    .pop_head = ring_pop_head,
+    .pop_tail = ring_pop_tail,
+    .gather = ring_gather,
+    .scatter = ring_scatter,
+    .absorb = ring_absorb,
+    .reserve = ring_reserve,
+    .reverse = ring_reverse,
+    .swap = ring_swap,
+    .reverse_k = ring_reverse_k,
+    .iter_first = ring_iter_first,
+    .iter_step = ring_iter_step,
+    .iter_at = ring_iter_at,
+    .iter_store = ring_iter_store,
+};
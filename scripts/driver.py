@@ -69,9 +69,11 @@ class Tracer:
                  verbLevel=0,
                  autograde=False,
                  useValgrind=False,
-                 colored=False):
+                 colored=False,
+                 backend=""):
         if qtest != "":
             self.qtest = qtest
+        self.backend = backend
         self.verbLevel = verbLevel
         self.autograde = autograde
         self.useValgrind = useValgrind
@@ -89,6 +91,8 @@ class Tracer:
         fname = "%s/%s.cmd" % (self.traceDirectory, self.traceDict[tid])
         vname = "%d" % self.verbLevel
         clist = self.command + ["-v", vname, "-f", fname]
+        if self.backend != "":
+            clist += ["-b", self.backend]
 
         try:
             retcode = subprocess.call(clist)
@@ -146,11 +150,12 @@ class Tracer:
             sys.exit(1)
 
 def usage(name):
-    print("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [--valgrind] [-c]" % name)
+    print("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [-b BACKEND] [--valgrind] [-c]" % name)
     print("  -h        Print this message")
     print("  -p PROG   Program to test")
     print("  -t TID    Trace ID to test")
     print("  -v VLEVEL Set verbosity level (0-3)")
+    print("  -b BACKEND Queue backend passed on to the program")
     print("  -c Enable colored text")
     sys.exit(0)
 
@@ -163,8 +168,9 @@ def run(name, args):
     autograde = False
     useValgrind = False
     colored = False
+    backend = ""
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind'])
+    optlist, args = getopt.getopt(args, 'hp:t:v:A:cb:', ['valgrind'])
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -181,6 +187,8 @@ def run(name, args):
             useValgrind = True
         elif opt == '-c':
             colored = True
+        elif opt == '-b':
+            backend = val
         else:
             print("Unrecognized option '%s'" % opt)
             usage(name)
@@ -190,7 +198,8 @@ def run(name, args):
                verbLevel=vlevel,
                autograde=autograde,
                useValgrind=useValgrind,
-               colored=colored)
+               colored=colored,
+               backend=backend)
     t.run(tid)
 
 
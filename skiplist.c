@@ -0,0 +1,307 @@
+#include <stdint.h>
+
+#include "pool.h"
+#include "skiplist.h"
+
+/* Levels of towers above the chain, enough for SKIP_SPAN^16 elements */
+#define SKIP_LEVELS 16
+
+/**
+ * skip_link_t - Forward link of a tower on one level
+ * @next: next tower as tall as this level, NULL past the last one
+ * @width: elements from this tower to @next, or to one past the tail
+ */
+typedef struct {
+    struct skip_tower *next;
+    size_t width;
+} skip_link_t;
+
+/**
+ * skip_tower_t - Forward links of one element
+ * @node: list node of the element, NULL for the header of the index
+ * @height: number of levels the tower reaches
+ * @link: one link per level, from the lowest up
+ */
+typedef struct skip_tower {
+    struct list_head *node;
+    int height;
+    skip_link_t link[];
+} skip_tower_t;
+
+/**
+ * skip_index - Index over the chain of one queue
+ * @header: tower standing before the first element, on every level
+ * @stale: the chain changed since the index was built
+ * @seed: state of the generator choosing the height of new towers
+ *
+ * Positions count from the header at 0, so the element of rank r is at
+ * r + 1 and one past the tail at n + 1.
+ */
+struct skip_index {
+    skip_tower_t *header;
+    bool stale;
+    uint64_t seed;
+};
+
+static skip_tower_t *tower_new(struct list_head *node, int height)
+{
+    skip_tower_t *t =
+        pool_alloc(sizeof(skip_tower_t) + height * sizeof(skip_link_t));
+    if (!t)
+        return NULL;
+
+    t->node = node;
+    t->height = height;
+    for (int i = 0; i < height; i++)
+        t->link[i].next = NULL;
+    return t;
+}
+
+/* Release every tower but the header.
+ *
+ * The time limit of qtest may cut this or skip_ready() short, and the index
+ * stays stale until a build completes, so the next call has to cope with
+ * whatever was left. Towers are therefore linked on level 0 only once their
+ * own links are NULL, and unlinked from there before they are freed.
+ */
+static void free_towers(skip_index_t *ix)
+{
+    skip_tower_t *t;
+    while ((t = ix->header->link[0].next)) {
+        ix->header->link[0].next = t->link[0].next;
+        pool_free(t);
+    }
+    for (int i = 0; i < SKIP_LEVELS; i++)
+        ix->header->link[i].next = NULL;
+}
+
+skip_index_t *skip_new(void)
+{
+    skip_index_t *ix = malloc(sizeof(skip_index_t));
+    if (!ix)
+        return NULL;
+
+    ix->header = tower_new(NULL, SKIP_LEVELS);
+    if (!ix->header) {
+        free(ix);
+        return NULL;
+    }
+    ix->stale = true;
+    ix->seed = 0x9e3779b97f4a7c15;
+    return ix;
+}
+
+void skip_free(skip_index_t *ix)
+{
+    if (!ix)
+        return;
+
+    free_towers(ix);
+    pool_free(ix->header);
+    free(ix);
+}
+
+void skip_invalidate(skip_index_t *ix)
+{
+    if (ix)
+        ix->stale = true;
+}
+
+bool skip_valid(const skip_index_t *ix)
+{
+    return ix && !ix->stale;
+}
+
+/* Build the index from scratch: the element at position p gets one level
+ * for every time SKIP_SPAN divides p, which spaces the towers evenly.
+ */
+bool skip_ready(skip_index_t *ix, struct list_head *head, size_t n)
+{
+    if (!ix->stale)
+        return true;
+
+    skip_tower_t *last[SKIP_LEVELS];
+    size_t last_pos[SKIP_LEVELS];
+
+    free_towers(ix);
+    for (int i = 0; i < SKIP_LEVELS; i++) {
+        last[i] = ix->header;
+        last_pos[i] = 0;
+    }
+
+    size_t pos = 0;
+    struct list_head *node;
+    list_for_each (node, head) {
+        pos++;
+        int height = 0;
+        for (size_t p = pos; height < SKIP_LEVELS && p % SKIP_SPAN == 0;
+             p /= SKIP_SPAN)
+            height++;
+        if (!height)
+            continue;
+
+        skip_tower_t *t = tower_new(node, height);
+        if (!t) {
+            free_towers(ix);
+            return false;
+        }
+        for (int i = 0; i < height; i++) {
+            last[i]->link[i].next = t;
+            last[i]->link[i].width = pos - last_pos[i];
+            last[i] = t;
+            last_pos[i] = pos;
+        }
+    }
+
+    for (int i = 0; i < SKIP_LEVELS; i++) {
+        last[i]->link[i].next = NULL;
+        last[i]->link[i].width = n + 1 - last_pos[i];
+    }
+    ix->stale = false;
+    return true;
+}
+
+/* Find, on every level, the last tower before position @pos, and where it
+ * stands
+ */
+static void find_before(skip_index_t *ix,
+                        size_t pos,
+                        skip_tower_t **update,
+                        size_t *update_pos)
+{
+    skip_tower_t *t = ix->header;
+    size_t at = 0;
+
+    for (int i = SKIP_LEVELS - 1; i >= 0; i--) {
+        while (t->link[i].next && at + t->link[i].width < pos) {
+            at += t->link[i].width;
+            t = t->link[i].next;
+        }
+        update[i] = t;
+        update_pos[i] = at;
+    }
+}
+
+struct list_head *skip_seek(skip_index_t *ix,
+                            struct list_head *head,
+                            size_t rank)
+{
+    skip_tower_t *t = ix->header;
+    size_t at = 0, pos = rank + 1;
+
+    for (int i = SKIP_LEVELS - 1; i >= 0; i--) {
+        while (t->link[i].next && at + t->link[i].width <= pos) {
+            at += t->link[i].width;
+            t = t->link[i].next;
+        }
+    }
+
+    struct list_head *node = t->node ? t->node : head;
+    for (; at < pos; at++)
+        node = node->next;
+    return node;
+}
+
+struct list_head *skip_search(skip_index_t *ix,
+                              struct list_head *head,
+                              const element_t *key,
+                              int (*cmp)(const element_t *, const element_t *),
+                              bool after_equal,
+                              size_t *rank)
+{
+    skip_tower_t *t = ix->header;
+    size_t at = 0;
+
+    /* Stay on elements before the result: less than @key, or not greater
+     * when @after_equal
+     */
+    for (int i = SKIP_LEVELS - 1; i >= 0; i--) {
+        skip_tower_t *next;
+        while ((next = t->link[i].next)) {
+            int r = cmp(list_entry(next->node, element_t, list), key);
+            if (r > 0 || (r == 0 && !after_equal))
+                break;
+            at += t->link[i].width;
+            t = next;
+        }
+    }
+
+    struct list_head *node = t->node ? t->node : head;
+    while (node->next != head) {
+        int r = cmp(list_entry(node->next, element_t, list), key);
+        if (r > 0 || (r == 0 && !after_equal))
+            break;
+        node = node->next;
+        at++;
+    }
+
+    *rank = at;
+    return node->next;
+}
+
+/* Height of a new tower: each level is reached with probability
+ * 1 / SKIP_SPAN, like the spacing skip_ready() builds
+ */
+static int random_height(skip_index_t *ix)
+{
+    uint64_t x = ix->seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    ix->seed = x;
+
+    int height = 0;
+    while (height < SKIP_LEVELS && x % SKIP_SPAN == 0) {
+        height++;
+        x /= SKIP_SPAN;
+    }
+    return height;
+}
+
+void skip_insert(skip_index_t *ix, struct list_head *node, size_t rank)
+{
+    skip_tower_t *update[SKIP_LEVELS];
+    size_t update_pos[SKIP_LEVELS], pos = rank + 1;
+
+    find_before(ix, pos, update, update_pos);
+
+    int height = random_height(ix);
+    skip_tower_t *t = height ? tower_new(node, height) : NULL;
+    if (!t)
+        height = 0;
+
+    for (int i = 0; i < SKIP_LEVELS; i++) {
+        skip_link_t *l = &update[i]->link[i];
+        if (i >= height) {
+            l->width++;
+            continue;
+        }
+
+        /* The tower after the new one moved up by one position */
+        t->link[i].next = l->next;
+        t->link[i].width = update_pos[i] + l->width + 1 - pos;
+        l->next = t;
+        l->width = pos - update_pos[i];
+    }
+}
+
+void skip_remove(skip_index_t *ix, size_t rank)
+{
+    skip_tower_t *update[SKIP_LEVELS];
+    size_t update_pos[SKIP_LEVELS], pos = rank + 1;
+    skip_tower_t *doomed = NULL;
+
+    find_before(ix, pos, update, update_pos);
+
+    for (int i = 0; i < SKIP_LEVELS; i++) {
+        skip_link_t *l = &update[i]->link[i];
+        if (l->next && update_pos[i] + l->width == pos) {
+            doomed = l->next;
+            l->width += doomed->link[i].width - 1;
+            l->next = doomed->link[i].next;
+        } else {
+            l->width--;
+        }
+    }
+    pool_free(doomed);
+}
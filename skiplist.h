@@ -0,0 +1,117 @@
+#ifndef LAB0_SKIPLIST_H
+#define LAB0_SKIPLIST_H
+
+/* Skip-list index over the chain of a list-backed queue.
+ *
+ * The chain itself is the bottom level. Above it, only some elements get a
+ * tower of forward links, about one in SKIP_SPAN per level, and every link
+ * records how many elements it jumps over. A search runs down the towers
+ * to the last one before its target and finishes with a few steps along
+ * the chain, so looking an element up by rank, or by value in a sorted
+ * queue, takes O(log n).
+ *
+ * queue.c keeps the index up to date through the operations which add or
+ * remove single elements at a known rank. Everything else only marks it
+ * stale, without touching the allocator, and the next lookup rebuilds it
+ * in one pass over the chain.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* One tower per SKIP_SPAN elements on the lowest level of the index */
+#define SKIP_SPAN 4
+
+typedef struct skip_index skip_index_t;
+
+/**
+ * skip_new() - Create an index, stale until built
+ *
+ * Return: the index, NULL for allocation failed
+ */
+skip_index_t *skip_new(void);
+
+/**
+ * skip_free() - Release an index and every tower in it
+ * @ix: the index, no effect if NULL
+ */
+void skip_free(skip_index_t *ix);
+
+/**
+ * skip_invalidate() - Mark an index stale after the chain changed
+ * @ix: the index, no effect if NULL
+ *
+ * Neither allocates nor frees, so it is safe where allocation is not.
+ */
+void skip_invalidate(skip_index_t *ix);
+
+/**
+ * skip_ready() - Make an index describe the chain, rebuilding it if stale
+ * @ix: the index
+ * @head: the chain
+ * @n: number of elements on @head
+ *
+ * Return: false for allocation failed, leaving the index stale
+ */
+bool skip_ready(skip_index_t *ix, struct list_head *head, size_t n);
+
+/**
+ * skip_valid() - Tell whether an index describes the chain right now
+ * @ix: the index, may be NULL
+ */
+bool skip_valid(const skip_index_t *ix);
+
+/**
+ * skip_seek() - Find the element at a rank
+ * @ix: a valid index of @head
+ * @head: the chain
+ * @rank: position from the head, starting at 0, less than the size
+ *
+ * Return: the list node of the element
+ */
+struct list_head *skip_seek(skip_index_t *ix,
+                            struct list_head *head,
+                            size_t rank);
+
+/**
+ * skip_search() - Find where a value belongs in a sorted chain
+ * @ix: a valid index of @head
+ * @head: the chain, in ascending order of @cmp
+ * @key: the value to look for
+ * @cmp: the order of the chain
+ * @after_equal: skip over the elements equal to @key too
+ * @rank: receives the number of elements before the result
+ *
+ * Return: the node of the first element greater than or equal to @key, or
+ * greater than @key if @after_equal; @head if there is none
+ */
+struct list_head *skip_search(skip_index_t *ix,
+                              struct list_head *head,
+                              const element_t *key,
+                              int (*cmp)(const element_t *, const element_t *),
+                              bool after_equal,
+                              size_t *rank);
+
+/**
+ * skip_insert() - Account for an element just linked into the chain
+ * @ix: a valid index of @head, before the insertion
+ * @node: the new element
+ * @rank: where it now is
+ *
+ * The element may get a tower of its own. Should that allocation fail it
+ * simply gets none, and the index stays valid.
+ */
+void skip_insert(skip_index_t *ix, struct list_head *node, size_t rank);
+
+/**
+ * skip_remove() - Account for an element just unlinked from the chain
+ * @ix: a valid index of @head, before the removal
+ * @rank: where the element was
+ *
+ * Releases its tower, if it had one.
+ */
+void skip_remove(skip_index_t *ix, size_t rank);
+
+#endif /* LAB0_SKIPLIST_H */
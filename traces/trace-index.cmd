@@ -0,0 +1,22 @@
+# Searches of a sorted queue with and without the skip-list index
+# Run with: ./qtest -v 3 -f traces/trace-index.cmd
+option fail 0
+option malloc 0
+new
+it RAND 100000
+sort
+# Without the index every search walks the queue
+time find m
+time is RAND 100
+# The first search after the sort rebuilds the index, the others descend it
+index on
+time find m
+time is RAND 10000
+is m 10
+time dv m
+# Rearranging the queue only marks the index stale
+reverse
+reverse
+time find m
+index off
+free
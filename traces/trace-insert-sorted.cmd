@@ -0,0 +1,15 @@
+# Compare q_insert_sorted with q_insert_tail followed by q_sort
+# Run with: ./qtest -v 3 -f traces/trace-insert-sorted.cmd
+option fail 0
+option malloc 0
+new
+ih RAND 100000
+sort
+# Close values: only the first insertion walks far, the rest start at the finger
+time is m 1000
+# Random values walk from the finger or an end, whichever is closer
+time is RAND 100
+# Insertion followed by sorting pays a whole sort for every element
+time it m
+time sort
+free
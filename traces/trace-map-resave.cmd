@@ -0,0 +1,19 @@
+# Saving over a snapshot file which queues are still mapped from
+# Run with: ./qtest -v 3 -f traces/trace-map-resave.cmd
+option fail 0
+option malloc 0
+new
+it dolphin
+it bear
+save /tmp/lab0-map-resave.bin
+map /tmp/lab0-map-resave.bin
+# The file is replaced, the mapped queue keeps the strings of the old one
+save /tmp/lab0-map-resave.bin
+prev
+rh dolphin
+save /tmp/lab0-map-resave.bin
+next
+rh dolphin
+rh bear
+load /tmp/lab0-map-resave.bin
+show
@@ -0,0 +1,16 @@
+# Mapping a snapshot file in place of loading it
+# Run with: ./qtest -v 3 -f traces/trace-map.cmd
+option fail 0
+option malloc 0
+new
+it RAND 100000
+ih a_string_too_long_to_fit_inside_the_element 1000
+save /tmp/lab0-map.bin
+# Loading copies every string, mapping only reads the string numbers
+time load /tmp/lab0-map.bin
+time map /tmp/lab0-map.bin
+# Mapped elements move and leave like any other
+sort
+rh
+rt
+show
@@ -0,0 +1,21 @@
+# Positional access with and without the skip-list index
+# Run with: ./qtest -v 3 -f traces/trace-position.cmd
+option fail 0
+option malloc 0
+new
+it a
+it b
+it c
+index on
+ia 1 x
+ia 4 y
+get 1
+da 0
+reverse
+get 0
+da 3
+dm
+free
+# Cost per operation as the queue grows: linear without the index,
+# logarithmic with it
+posbench 262144 1000
@@ -0,0 +1,37 @@
+# Operations which have to do without their scratch buffers
+# Run with: ./qtest -v 3 -f traces/trace-scratch-fail.cmd
+# and again with -b ring and -b chunk, which sort and merge through the
+# list nodes of their elements instead
+option fail 10
+option malloc 0
+new
+it RAND 500
+new
+it RAND 500
+sort
+new
+it RAND 500
+sort
+new
+it RAND 500
+sort
+prev
+prev
+prev
+# Every scratch allocation fails from here on
+option malloc 100
+# The array sort falls back to the merge sort
+option sort 4
+sort
+option sort 0
+# Fisher-Yates over an array becomes a walk along the list, or nothing
+shuffle
+sort
+# Without a table no value can be counted, so the queue is left alone
+dedup hash
+# The heap merge folds the queues pairwise, the parallel one merges in turn
+option threads 4
+option merge 1
+merge
+option malloc 0
+shuffle
@@ -0,0 +1,15 @@
+# Saving every queue to a snapshot file and loading it back
+# Run with: ./qtest -v 3 -f traces/trace-snapshot.cmd
+option fail 0
+option malloc 0
+new
+it RAND 1000000
+new
+ih dolphin 1000
+reverse
+it bear 10
+# Repeated strings are stored once in the string table
+time save /tmp/lab0-snapshot.bin
+# The loaded queues come after the ones already in the chain
+time load /tmp/lab0-snapshot.bin
+show